@@ -166,6 +166,20 @@ def rigidXstd_vector(rigid, mat_std):
         out.SetCoords(i, coords2)
     return out
 
+# limits the moves of the ligand during a minimization
+def setBox(minimizer, halfwidth):
+    #variables of the ligand: 3 Euler angles then 3 translations.
+    #angles stay unbounded (a rotation may cross +-pi), see wrapAngle()
+    for i in range(3):
+        minimizer.SetBounds(i+3, -halfwidth, halfwidth)
+
+# brings an angle back to [-pi,pi[ (same rotation)
+def wrapAngle(angle):
+    if -math.pi <= angle < math.pi:
+        return angle
+    return (angle + math.pi) % (2.0*math.pi) - math.pi
+
+
 # check if a required file is found
 def checkFile(name, comment):
     flag = os.path.exists(name)
@@ -186,6 +200,9 @@ parser.add_option("-l", "--ligand", action="store", type="string", dest="ligand_
 parser.add_option("-s", "--single", action="store_true", dest="single", default=False, help="single minimization mode")
 parser.add_option("--ref", action="store", type="string", dest="reffile", help="reference ligand for rmsd" )
 parser.add_option("-t", "--translation", action="store", type="int", dest="transnb", help="translation number (distributed mode) starting from 0 for the first one!")
+parser.add_option("--box", action="store", type="float", dest="box", help="the ligand translation is limited to a box of half-width BOX (A) around its starting position at each minimization (Euler angles are not bounded, they are wrapped to [-pi,pi[)")
+parser.add_option("--warmstart", action="store_true", dest="warmstart", default=False, help="start each minimization with the lbfgs history of the previous one (same translation)")
+parser.add_option("--warmstart-stats", action="store_true", dest="warmstartstats", default=False, help="measurement mode: every minimization is done with and without warm start, the total number of iterations is reported")
 (options, args) = parser.parse_args()
 
 
@@ -291,11 +308,17 @@ if (options.transnb!=None):
     if transnb!=trans.Size()-1:
         printFiles=False #don't append ligand, receptor, etc. unless this is the last translation point of the simulation
 
+if options.warmstartstats:
+    options.warmstart=True
+coldtotal=0  #number of iterations (warmstart-stats mode)
+warmtotal=0
+
 # core attract algorithm
 for trans in translations:
     transnb+=1
     print "@@@@@@@ Translation nb %i @@@@@@@" %(transnb)
     rotnb=0
+    previous_minimizer=None  #lbfgs history is reused between minimizations of the same translation
     for rot in rotations:
         rotnb+=1
         print "----- Rotation nb %i -----"%rotnb
@@ -324,8 +347,25 @@ for trans in translations:
             rstk=minim['rstk']  #restraint force
             #if rstk>0.0:
                 #forcefield.SetRestraint(rstk)
+            if options.warmstartstats:
+                #reference minimization without history, on a copy of the system
+                coldff=AttractForceField1("aminon.par",surreal(cutoff))
+                coldff.AddLigand(rec)
+                coldff.AddLigand(AttractRigidbody(ligand))
+                cold_minimizer=Lbfgs(coldff)
+                if options.box:
+                    setBox(cold_minimizer, options.box)
+                cold_minimizer.minimize(niter)
+                coldtotal+=cold_minimizer.GetNumberIter()
+
             lbfgs_minimizer=Lbfgs(forcefield)
+            if options.warmstart and previous_minimizer is not None:
+                lbfgs_minimizer.SetHistory(previous_minimizer)
+            if options.box:
+                setBox(lbfgs_minimizer, options.box)
             lbfgs_minimizer.minimize(niter)
+            warmtotal+=lbfgs_minimizer.GetNumberIter()
+            previous_minimizer=lbfgs_minimizer
             X=lbfgs_minimizer.GetMinimizedVars()  #optimized freedom variables after minimization
 
 
@@ -333,7 +373,7 @@ for trans in translations:
             output=AttractRigidbody(ligand)
             center=output.FindCenter()
             output.Translate(Coord3D()-center)
-            output.AttractEulerRotate(surreal(X[0]), surreal(X[1]), surreal(X[2]))
+            output.AttractEulerRotate(surreal(wrapAngle(X[0])), surreal(wrapAngle(X[1])), surreal(wrapAngle(X[2])))
             output.Translate(Coord3D(surreal(X[3]),surreal(X[4]),surreal(X[5])))
             output.Translate(center)
 
@@ -378,6 +418,11 @@ if (options.single):
     ftraj.close()
     print "Saved all minimization variables (translations/rotations) in %s" %(trjname)
 
+if options.warmstartstats:
+    print "lbfgs iterations without warm start: %d, with warm start: %d" %(coldtotal, warmtotal)
+    if coldtotal > 0:
+        print "iteration count reduction: %.1f %%" %(100.0*(coldtotal-warmtotal)/coldtotal)
+
 # print end and elapsed time
 time_end = datetime.datetime.now()
 #print "Finished at: ",now.strftime("%A %B %d %Y, %H:%M")
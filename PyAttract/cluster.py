@@ -13,8 +13,6 @@
 ## specify the -r or -e option (default value for both = 1.0)
 ## if you want to increase the number of best solution (according to the energy) that are clustered
 ## specify the -s (or --nstruct) option. (default=2000)
-## if you want to increase the number of cluster that are compared to the current structure 
-## during the clustering process, specify the -c (or --cluster_memory) option (default=50)
 ##
 ## for example, to increase the scut and increase the Rmsd cutoff value,
 ## the following command should be used:
@@ -38,10 +36,10 @@ limit_ener = 1.0e30
 
 class Clusterize(NoRecalc):
     def generate(self, db, dep, args):
-        retval = cluster(args[0],args[1],args[2],args[3])
+        retval = cluster(args[0],args[1],args[2])
         d = shelve.open(db)
         d['data']=retval
-        d['args']=args[2:4]
+        d['args']=args[2:]
         d.close()
         return retval
 
@@ -51,7 +49,7 @@ class Clusterize(NoRecalc):
 
     def checkArgs(self, dbf, args):
         d = shelve.open(dbf)
-        return d['args']== args[2:4]
+        return d['args']== args[2:]
 
 
 
@@ -81,37 +79,24 @@ class StructureI:
 
 
 
-def cluster(lig,structures, nstruct, cluster_memory):
-    cluster_memory_= cluster_memory+1
-    thecluster = []
+def cluster(lig,structures, nstruct):
+    structures = [s for s in structures if s.ener<=0]
 
-    structures.sort(key=lambda i: i.ener)
-
-    for s in structures[:nstruct]:
-        if s.ener>0:
-            break
-        new=True
-        sc = extract.rigidXMat44(lig,s.matrix)
-
-        for c in reversed(thecluster[-cluster_memory:]):
-            if ( ( c.ext.ener-s.ener < limit_ener ) and ( Rmsd(sc,c.structure) < limit_rmsd ) ):
-            #if Rmsd(sc,c.structure)< limit_rmsd:
-                c.count += 1
-                new=False
-                #print "stuct added to a cluster"
-                break
-        if new==True:
-            c = Struct()
-            c.structure = sc
-            c.ext = s
-            c.count = 1
-            thecluster.append(c)
-            if len(thecluster) > cluster_memory:
-                del thecluster[-cluster_memory_].structure
-            #print "new cluster"
-    
-    for i in thecluster:
-        if hasattr(i,"structure"): del i.structure
+    engine = PoseClustering(lig, limit_rmsd, limit_ener)
+    for s in structures:
+        mat = Vdouble()
+        for line in s.matrix:
+            for value in line:
+                mat.append(value)
+        engine.AddPose(s.ener, mat)
+    engine.Run(nstruct)
+
+    thecluster = []
+    for i in range(engine.NbClusters()):
+        c = Struct()
+        c.ext = structures[engine.GetRepresentative(i)]
+        c.count = engine.GetClusterSize(i)
+        thecluster.append(c)
     thecluster.sort(key=lambda i: i.ext.ener)
     return thecluster
 
@@ -123,14 +108,12 @@ if (__name__=="__main__"):
     parser.add_option("-e", "--energy_cutoff", action="store", type="float", dest="energy_cutoff", help="Energy cutoff value (default=1000.0)")
     parser.add_option("-r", "--rmsd_cutoff", action="store", type="float", dest="rmsd_cutoff", help="Rmsd cutoff value (default=1.0)")
     parser.add_option("-n", "--nstruct", action="store", type="int", dest="nstruct", help="number of structures to cluster, an increase of this value will increase significantly the time processing (default = 2000)")
-    parser.add_option("-m", "--memory", action="store", type="int", dest="cluster_memory",default=50, help="only the latest m clusters are compared during the clustering process, an increase of this value will increase significantly the time processing  (default=50)")
     (options, args) = parser.parse_args()
     
     
     
 
     nstruct=2000
-    #cluster_memory=50
     
     if (options.energy_cutoff):
         limit_ener=options.energy_cutoff
@@ -138,8 +121,6 @@ if (__name__=="__main__"):
         limit_rmsd=options.rmsd_cutoff
     if (options.nstruct):
         nstruct=options.nstruct
-    if (options.cluster_memory):
-        cluster_memory=options.cluster_memory
 
 
     outputfile = sys.argv[1]
@@ -161,7 +142,7 @@ if (__name__=="__main__"):
 
 
     dependencies=[outputfile]
-    args = [lig,structures, nstruct, cluster_memory]
+    args = [lig,structures, nstruct, limit_rmsd, limit_ener]
 
 
 
@@ -0,0 +1,22 @@
+#!/usr/bin/env python
+
+from ptools import *
+import sys
+import os
+
+
+def main():
+    if len(sys.argv) < 3:
+        print "usage: convertstructures.py input_directory output_directory"
+        print "converts the .pdb and .red files of input_directory to binary structure files"
+        sys.exit(1)
+    indir = sys.argv[1]
+    outdir = sys.argv[2]
+    if not os.path.isdir(outdir):
+        os.makedirs(outdir)
+
+    converted = ConvertStructures(indir, outdir)
+    print converted, "files converted"
+
+if __name__ == "__main__":
+    main()
@@ -30,45 +30,9 @@ def irmsd(receptor, ligref, ligprobe, receptorprobe=None,reducedmodel=False):
     cutoff = 10.0 
     if reducedmodel: cutoff = 2.0*7.0  #twice the threshold for residue-residue contacts    
     
-    recBB = receptor.Backbone().CreateRigid() #receptor backbone
-    ligrefBB = ligref.Backbone().CreateRigid()
-    
-    #creating list of residues in interaction:
-    recResidues={}
-    ligResidues={}
-    pairlist = AttractPairList(receptor, ligref, cutoff) #pairlist created on protein backbone + side-chains
-    for i in range(pairlist.Size()):
-        atompair = pairlist[i]
-        ligindex = atompair.atlig
-	recindex = atompair.atrec
-	
-        atom = ligref.CopyAtom(ligindex)
-        ligResidues[ atom.GetResidId() ]=1
-
-	atom = receptor.CopyAtom(recindex)
-	recResidues[ atom.GetResidId() ]=1
-
-    ligResidues = sorted(ligResidues.keys())  #get a list of the ligand's residues in interaction
-    recResidues = sorted(recResidues.keys())
-
-    ligrefBBInterface=selectListOfResidues(ligrefBB,ligResidues) #interface backbone residues of reference ligand
-    ligBBInterface = ligprobe.Backbone() & selectListOfResidues(ligprobe,ligResidues) #interface bb residues of docked ligand
-    receptorBBInterface=selectListOfResidues(recBB,recResidues)
-    
-    if (options.superpose):
-        ligrefpdb=ligrefBBInterface.CreateRigid()
-        ligdockpdb=ligBBInterface.CreateRigid()
-        recrefpdb=receptorBBInterface.CreateRigid()
-        ref=Rigidbody(ligrefpdb+recrefpdb)
-        pred=Rigidbody(ligdockpdb+recrefpdb)
-        super= superpose(ref,pred,0)
-        mat=super.matrix
-        pred.ApplyMatrix(mat)
-        assert(ligrefBBInterface.Size()==ligBBInterface.Size())
-        return Rmsd(pred,ref)
-    else:
-        assert(ligrefBBInterface.Size()==ligBBInterface.Size())
-        return Rmsd(ligrefBBInterface, ligBBInterface)
+    evaluator = InterfaceEvaluator(receptor, ligref, 7.0, cutoff)
+    evaluator.SetInterfaceSuperposition(options.superpose)
+    return evaluator.Irmsd(ligprobe)
 
 
 from optparse import OptionParser
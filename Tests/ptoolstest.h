@@ -2,6 +2,11 @@
 #include <ptools.h>
 
 #include <cstdlib>
+#include <set>
+#include <sstream>
+#include <cstdio>
+#include <limits>
+#include <unistd.h>
 
 #include <cxxtest/TestSuite.h>
 
@@ -115,6 +120,362 @@ Coord3D A, B;
         }
     }
 
+    void testSelectionView()
+    {
+        //the view follows the moves of the rigidbody
+        r.Translate(Coord3D(1.0, 2.0, 3.0));
+        AtomSelection ca = r.CA();
+        SelectionCoords view = ca.GetCoordsView();
+        TS_ASSERT_EQUALS(view.size, ca.Size());
+        Rigidbody carigid = ca.CreateRigid();
+        for (uint i=0; i<ca.Size(); i++)
+            TS_ASSERT_EQUALS(view[i], carigid.GetCoords(i));
+        TS_ASSERT(Norm(ca.FindCenter() - carigid.FindCenter()) < 1e-9);
+
+        //superposition of selections
+        Rigidbody moved(r);
+        moved.AttractEulerRotate(0.2, 0.5, -0.1);
+        moved.Translate(Coord3D(-4.0, 0.0, 2.0));
+        Superpose_t sel = superpose(r.CA(), moved.CA());
+        Superpose_t rig = superpose(carigid, moved.CA().CreateRigid());
+        TS_ASSERT(sel.matrix.almostEqual(rig.matrix, 1e-9));
+        TS_ASSERT_DELTA(Rmsd(r.CA(), moved.CA()), Rmsd(carigid, moved.CA().CreateRigid()), 1e-9);
+    }
+
+    /// first word of columns start..last, as the former readatomtype/readresidtype (clipped to the line)
+    static std::string oldWord(const std::string& line, uint start, uint last)
+    {
+        uint i = start;
+        while (i < line.size() && line[i] == ' ')
+            if (++i > last) return "";
+        uint j = i;
+        while (j < line.size() && line[j] != ' ') j++;
+        std::string word = line.substr(std::min<size_t>(i, line.size()), j - std::min<size_t>(i, line.size()));
+        std::transform(word.begin(), word.end(), word.begin(), (int(*)(int)) toupper);
+        return word;
+    }
+
+    /// field of the former reader: substr() of the line, empty after its end
+    static std::string oldField(const std::string& line, uint start, uint length)
+    {
+        return start < line.size() ? line.substr(start, length) : "";
+    }
+
+    /// the former getline/substr/atof reader, with fields clipped to the line
+    static void oldReadPDB(const std::string& content, Rigidbody& protein)
+    {
+        std::istringstream file(content);
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (line.size() < 10 || line.substr(0,6) != "ATOM  ") continue;
+            Coord3D pos(atof(oldField(line, 30, 8).c_str()), atof(oldField(line, 38, 8).c_str()), atof(oldField(line, 46, 8).c_str()));
+            Atomproperty a;
+            a.SetType(oldWord(line, 12, 15));
+            a.SetResidType(oldWord(line, 17, 19));
+            a.SetChainId(oldField(line, 21, 1));
+            a.SetResidId(atoi(oldField(line, 22, 4).c_str()));
+            a.SetAtomId(atoi(oldField(line, 6, 5).c_str()));
+            a.SetExtra(oldField(line, 54, line.size()));
+            protein.AddAtom(a, pos);
+        }
+    }
+
+    static void checkSameAtoms(const Rigidbody& r1, const Rigidbody& r2)
+    {
+        TS_ASSERT_EQUALS(r1.Size(), r2.Size());
+        for (uint i=0; i<r1.Size() && i<r2.Size(); i++)
+        {
+            const Atomproperty& a1 = r1.GetAtomProperty(i);
+            const Atomproperty& a2 = r2.GetAtomProperty(i);
+            TS_ASSERT_EQUALS(a1.GetType(), a2.GetType());
+            TS_ASSERT_EQUALS(a1.GetResidType(), a2.GetResidType());
+            TS_ASSERT_EQUALS(a1.GetChainId(), a2.GetChainId());
+            TS_ASSERT_EQUALS(a1.GetResidId(), a2.GetResidId());
+            TS_ASSERT_EQUALS(a1.GetAtomId(), a2.GetAtomId());
+            TS_ASSERT_EQUALS(a1.GetExtra(), a2.GetExtra());
+            Coord3D c1 = r1.GetCoords(i), c2 = r2.GetCoords(i);
+            TS_ASSERT(sameReal(c1.x, c2.x) && sameReal(c1.y, c2.y) && sameReal(c1.z, c2.z));
+        }
+    }
+
+    static bool sameReal(dbl a, dbl b) {return a == b || (a != a && b != b);} ///< equal, or both nan
+
+    void testReadPDB()
+    {
+        const std::string atom = "ATOM     12  CA  ALA A  23      11.104   6.134  -6.504    1   0.000 0 0";
+        std::string content;
+        content += "REMARK a remark\n";
+        content += atom + "\n";
+        content += atom + "\r\n";                                            //CRLF
+        content += atom.substr(0, 54) + "\r\n";                              //no extra field
+        content += atom.substr(0, 50) + "\n";                                 //shorter than 54 columns
+        content += atom.substr(0, 42) + "\r\n";
+        content += atom.substr(0, 14) + "\n";
+        content += atom.substr(0, 30) + "  1.5e+1-2.50E-1     nan\n";         //exponents and nan
+        content += atom.substr(0, 30) + "-1234.567-2345.678 3456.789\n";      //overflowing coordinates
+        content += atom.substr(0, 30) + "   0.1    -.5 +12.\n";
+        content += "HETATM   13  O   HOH W   1       1.000   2.000   3.000\n";
+        content += "\n";
+        content += atom;                                                      //no final newline
+
+        Rigidbody reference;
+        oldReadPDB(content, reference);
+        TS_ASSERT_EQUALS(reference.Size(), 10u);
+
+        {
+            std::ofstream file("readpdb_test.pdb", std::ios::binary);
+            file << content;
+        }
+        Rigidbody mapped, streamed;
+        ReadPDB("readpdb_test.pdb", mapped);
+        std::ifstream file("readpdb_test.pdb", std::ios::binary);
+        ReadPDB(file, streamed);
+        file.close();
+        checkSameAtoms(reference, mapped);
+        checkSameAtoms(reference, streamed);
+        TS_ASSERT(mapped.GetCoords(6).z != mapped.GetCoords(6).z); //nan
+
+        //empty file
+        {
+            std::ofstream empty("readpdb_test.pdb");
+        }
+        Rigidbody none, nonestreamed;
+        ReadPDB("readpdb_test.pdb", none);
+        std::ifstream emptyfile("readpdb_test.pdb");
+        ReadPDB(emptyfile, nonestreamed);
+        TS_ASSERT_EQUALS(none.Size(), 0u);
+        TS_ASSERT_EQUALS(nonestreamed.Size(), 0u);
+        remove("readpdb_test.pdb");
+    }
+
+    void testAttractFields()
+    {
+        //the reader gives the values of a stream reading of the extra field
+        const char* files[] = {"pk6a.red", "pk6c.red", "1FIN_r.pdb"};
+        for (uint f=0; f<3; f++)
+        {
+            Rigidbody rig(files[f]);
+            uint parsed = 0;
+            for (uint i=0; i<rig.Size(); i++)
+            {
+                const Atomproperty& at = rig.GetAtomProperty(i);
+                if (!at.HasAttractFields()) continue;
+                parsed++;
+                std::istringstream iss(at.GetExtra());
+                uint category;
+                dbl charge;
+                TS_ASSERT(iss >> category >> charge);
+                TS_ASSERT_EQUALS(at.GetAtomCategory(), category);
+                TS_ASSERT_EQUALS(at.GetAttractCharge(), charge);
+            }
+            if (f < 2) TS_ASSERT_EQUALS(parsed, rig.Size());
+        }
+
+        Rigidbody red("pk6a.red");
+        Rigidbody unparsed;
+        ReadPDB("pk6a.red", unparsed, false);
+        TS_ASSERT(!unparsed.GetAtomProperty(0).HasAttractFields());
+        AttractRigidbody a(red), b(unparsed);
+        for (uint i=0; i<red.Size(); i++)
+        {
+            TS_ASSERT_EQUALS(a.getAtomTypeNumber(i), b.getAtomTypeNumber(i));
+            TS_ASSERT_EQUALS(a.getCharge(i), b.getCharge(i));
+        }
+
+        //a new extra field replaces the parsed values
+        Atomproperty at = red.GetAtomProperty(0);
+        at.SetExtra("    7  -1.500 0 0");
+        red.SetAtomProperty(0, at);
+        TS_ASSERT(!red.GetAtomProperty(0).HasAttractFields());
+        AttractRigidbody c(red);
+        TS_ASSERT_EQUALS(c.getAtomTypeNumber(0), 6u);
+        TS_ASSERT_EQUALS(c.getCharge(0), -1.5);
+
+        //the general charge is independent of the Attract charge
+        Atomproperty charged = red.GetAtomProperty(1);
+        dbl attractcharge = charged.GetAttractCharge();
+        charged.SetAtomCharge(2.0);
+        TS_ASSERT(charged.HasAttractFields());
+        TS_ASSERT_EQUALS(charged.GetAttractCharge(), attractcharge);
+    }
+
+    void testMixedAttractFields()
+    {
+        //a record without Attract fields between two records with them
+        const std::string atom = "ATOM     12  CA  ALA A  23      11.104   6.134  -6.504";
+        {
+            std::ofstream file("mixed_test.pdb");
+            file << atom << "    7  -1.500 0 0\n";
+            file << atom << "  1.00  0.00\n";
+            file << atom << "\n";
+            file << atom << "    3   0.250 0 0\n";
+        }
+        Rigidbody mixed;
+        ReadPDB("mixed_test.pdb", mixed);
+        remove("mixed_test.pdb");
+        TS_ASSERT_EQUALS(mixed.Size(), 4u);
+
+        const Atomproperty& first = mixed.GetAtomProperty(0);
+        TS_ASSERT(first.HasAttractFields());
+        TS_ASSERT_EQUALS(first.GetAtomCategory(), 7u);
+        TS_ASSERT_EQUALS(first.GetAttractCharge(), -1.5);
+        TS_ASSERT_EQUALS(first.GetAtomCharge(), 0.0);
+        for (uint i=1; i<3; i++)
+        {
+            const Atomproperty& at = mixed.GetAtomProperty(i);
+            TS_ASSERT(!at.HasAttractFields());
+            TS_ASSERT_EQUALS(at.GetAtomCategory(), 0u);
+            TS_ASSERT_EQUALS(at.GetAttractCharge(), 0.0);
+            TS_ASSERT_EQUALS(at.GetAtomCharge(), 0.0);
+        }
+        TS_ASSERT_EQUALS(mixed.GetAtomProperty(3).GetAtomCategory(), 3u);
+        TS_ASSERT_EQUALS(mixed.GetAtomProperty(3).GetAttractCharge(), 0.25);
+
+        //same values as the stream reading of the extra fields
+        Rigidbody unparsed;
+        std::ofstream file("mixed_test.pdb");
+        for (uint i=0; i<mixed.Size(); i++) file << atom << mixed.GetAtomProperty(i).GetExtra() << "\n";
+        file.close();
+        ReadPDB("mixed_test.pdb", unparsed, false);
+        remove("mixed_test.pdb");
+        AttractRigidbody a(mixed), b(unparsed);
+        for (uint i=0; i<mixed.Size(); i++)
+        {
+            TS_ASSERT_EQUALS(a.getAtomTypeNumber(i), b.getAtomTypeNumber(i));
+            TS_ASSERT_EQUALS(a.getCharge(i), b.getCharge(i));
+        }
+    }
+
+    void testBinaryStructure()
+    {
+        Rigidbody red("pk6a.red");
+        red.Translate(Coord3D(1.0, -2.0, 0.5)); //moved coordinates are written
+        WriteBinaryStructure(red, "pk6a_test.bin");
+        TS_ASSERT(IsBinaryStructure("pk6a_test.bin"));
+        TS_ASSERT(!IsBinaryStructure("pk6a.red"));
+
+        Rigidbody bin("pk6a_test.bin");
+        TS_ASSERT_EQUALS(bin.Size(), red.Size());
+        for (uint i=0; i<red.Size(); i++)
+        {
+            Atom a = red.CopyAtom(i);
+            Atom b = bin.CopyAtom(i);
+            TS_ASSERT_EQUALS(a.GetCoords(), b.GetCoords());
+            TS_ASSERT_EQUALS(a.GetType(), b.GetType());
+            TS_ASSERT_EQUALS(a.GetResidType(), b.GetResidType());
+            TS_ASSERT_EQUALS(a.GetChainId(), b.GetChainId());
+            TS_ASSERT_EQUALS(a.GetResidId(), b.GetResidId());
+            TS_ASSERT_EQUALS(a.GetAtomId(), b.GetAtomId());
+            TS_ASSERT_EQUALS(a.GetExtra(), b.GetExtra());
+        }
+
+        AttractRigidbody att(red), attbin("pk6a_test.bin");
+        for (uint i=0; i<red.Size(); i++)
+        {
+            TS_ASSERT_EQUALS(att.getAtomTypeNumber(i), attbin.getAtomTypeNumber(i));
+            TS_ASSERT_EQUALS(att.getCharge(i), attbin.getCharge(i));
+        }
+
+        //truncated file
+        FILE* file = fopen("pk6a_test.bin", "r+b");
+        TS_ASSERT(file != 0);
+        if (file) {TS_ASSERT_EQUALS(ftruncate(fileno(file), 100), 0); fclose(file);}
+        Rigidbody truncated;
+        TS_ASSERT_THROWS(ReadBinaryStructure("pk6a_test.bin", truncated), std::invalid_argument);
+        TS_ASSERT_THROWS(ReadBinaryStructure("pk6a.red", truncated), std::invalid_argument);
+        remove("pk6a_test.bin");
+    }
+
+    void testPDBWriter()
+    {
+        Rigidbody lig("pk6c.red");
+        std::string lines;
+        for (uint i=0; i<lig.Size(); i++) lines += lig.CopyAtom(i).ToPdbString();
+        TS_ASSERT_EQUALS(lig.PrintPDB(), lines);
+
+        {
+            PDBWriter writer("pk6c_test.pdb", false, 1000); //small buffer: several writes
+            writer.WriteModel(lig, 1);
+            lig.Translate(Coord3D(1.0, 0.0, 0.0));
+            writer.WriteModel(lig, 2);
+            TS_ASSERT_EQUALS(writer.NbModels(), 2u);
+        }
+        {
+            PDBWriter writer("pk6c_test.pdb", true);
+            lig.Translate(Coord3D(1.0, 0.0, 0.0));
+            writer.WriteModel(lig, 3);
+            writer.Close();
+            TS_ASSERT_THROWS(writer.Write(lig), std::runtime_error);
+        }
+
+        std::ifstream file("pk6c_test.pdb");
+        std::string line, models;
+        while (std::getline(file, line))
+            if (line.substr(0, 5) == "MODEL" || line == "ENDMDL") models += line + "|";
+        TS_ASSERT_EQUALS(models, "MODEL        1|ENDMDL|MODEL        2|ENDMDL|MODEL        3|ENDMDL|");
+
+        Rigidbody all("pk6c_test.pdb");
+        TS_ASSERT_EQUALS(all.Size(), 3*lig.Size());
+        for (uint i=0; i<lig.Size(); i++)
+            TS_ASSERT(Norm(all.GetCoords(2*lig.Size()+i) - lig.GetCoords(i)) < 1e-3);
+
+        WritePDB(lig, "pk6c_test.pdb");
+        std::ifstream single("pk6c_test.pdb");
+        std::ostringstream content;
+        content << single.rdbuf();
+        TS_ASSERT_EQUALS(content.str(), lig.PrintPDB());
+        remove("pk6c_test.pdb");
+    }
+
+    void testPDBLineFormat()
+    {
+        //AppendPDBLine is the %8.3f format of snprintf, on the values where rounding is delicate
+        const dbl values[] = {0.0, -0.0, 0.0004, -0.0004, 0.0005, -0.0005, 0.0015, 0.0625, -0.0625, 1.0005,
+                              2.0015, 1.2345, -1.2345, 12.3455, 999.9995, -999.9995, 0.00049999999, 99999.9995,
+                              999999.999, 1e6, -1e6, 1234567.8905, 1e8, 1e9, -1e12, 1e300, 1e-300,
+                              std::numeric_limits<dbl>::quiet_NaN(), std::numeric_limits<dbl>::infinity(),
+                              -std::numeric_limits<dbl>::infinity()};
+        const uint nvalues = sizeof(values)/sizeof(values[0]);
+        const int ids[] = {1, 0, 99999, 100000, -5, -12345, 2147483647};
+
+        Atomproperty at;
+        at.SetType("CA");
+        at.SetResidType("ALA");
+        at.SetChainId("A");
+        at.SetExtra("    1   0.000 0 0");
+        char buffer[1024];
+        for (uint i=0; i<nvalues; i++)
+            for (uint k=0; k<sizeof(ids)/sizeof(ids[0]); k++)
+            {
+                at.SetAtomId(ids[k]);
+                at.SetResidId(-ids[k]);
+                Coord3D co(values[i], values[(i+1)%nvalues], -values[i]);
+                snprintf(buffer, sizeof(buffer), "ATOM  %5d  %-4s%3s %1s%4d    %8.3f%8.3f%8.3f%s\n", ids[k], "CA", "ALA", "A", -ids[k],
+                         (double) co.x, (double) co.y, (double) co.z, "    1   0.000 0 0");
+                std::string line;
+                AppendPDBLine(line, at, co);
+                TS_ASSERT_EQUALS(line, std::string(buffer));
+            }
+
+        //exact halves of thousandths and their neighbours
+        at.SetAtomId(1);
+        at.SetResidId(1);
+        for (int n=-20000; n<=20000; n++)
+        {
+            dbl x = (n + 0.5)/1000.0;
+            dbl neighbours[3] = {x, nextafter(x, 1e300), nextafter(x, -1e300)};
+            for (uint j=0; j<3; j++)
+            {
+                Coord3D co(neighbours[j], -neighbours[j], n/1000.0);
+                snprintf(buffer, sizeof(buffer), "%8.3f%8.3f%8.3f", (double) co.x, (double) co.y, (double) co.z);
+                std::string line;
+                AppendPDBLine(line, at, co);
+                TS_ASSERT_EQUALS(line.substr(30, 24), std::string(buffer));
+            }
+        }
+    }
+
 };
 
 
@@ -288,6 +649,100 @@ Rigidbody prot1;
 
    }
 
+    void testRmsdAndCoords()
+    {
+        //distorted copy: the fit is not exact
+        Rigidbody prot2(prot1);
+        std::vector<Coord3D> c1, c2;
+        for (uint i=0; i<prot2.Size(); i++)
+        {
+            Coord3D c = prot2.GetCoords(i);
+            c.x += (random.random()-0.5)*2.0;
+            prot2.SetCoords(i, c);
+        }
+        prot2.AttractEulerRotate(0.3, 1.2, -0.7);
+        prot2.Translate(Coord3D(5.0, -3.0, 12.0));
+        for (uint i=0; i<prot1.Size(); i++)
+        {
+            c1.push_back(prot1.GetCoords(i));
+            c2.push_back(prot2.GetCoords(i));
+        }
+
+        Superpose_t sup = superpose(prot1, prot2);
+        Superpose_t supcoords = superposeCoords(&c1[0], &c2[0], c1.size());
+        for (uint i=0; i<4; i++)
+            for (uint j=0; j<4; j++)
+                TS_ASSERT_DELTA(sup.matrix(i,j), supcoords.matrix(i,j), 1e-9);
+
+        //the rmsd is the one of the superposed structures
+        prot2.ApplyMatrix(sup.matrix);
+        TS_ASSERT(sup.rmsd > 0.1);
+        TS_ASSERT_DELTA(sup.rmsd, Rmsd(prot1, prot2), 1e-9);
+        TS_ASSERT_DELTA(supcoords.rmsd, sup.rmsd, 1e-9);
+        TS_ASSERT_THROWS(superposeCoords(&c1[0], &c2[0], 0), std::invalid_argument);
+    }
+
+    void testSuperposer()
+    {
+        Superposer sup(prot1);
+        TS_ASSERT_EQUALS(sup.Size(), prot1.Size());
+
+        //batch of distorted and moved copies, stored one after the other
+        std::vector<Coord3D> models;
+        std::vector<Superpose_t> reference;
+        for (uint m=0; m<5; m++)
+        {
+            Rigidbody prot2(prot1);
+            for (uint i=0; i<prot2.Size(); i++)
+            {
+                Coord3D c = prot2.GetCoords(i);
+                c.y += (random.random()-0.5)*m;
+                prot2.SetCoords(i, c);
+            }
+            prot2.AttractEulerRotate(0.5*m, 1.0, -0.3*m);
+            prot2.Translate(Coord3D(10.0*m, 50.0, -20.0));
+            reference.push_back(superpose(prot1, prot2));
+            for (uint i=0; i<prot2.Size(); i++)
+                models.push_back(prot2.GetCoords(i));
+        }
+
+        std::vector<dbl> matrices, rmsds;
+        sup.fit(models, matrices, rmsds);
+        TS_ASSERT_EQUALS(rmsds.size(), 5);
+        TS_ASSERT_EQUALS(matrices.size(), 5*16);
+        for (uint m=0; m<5; m++)
+        {
+            TS_ASSERT_DELTA(rmsds[m], reference[m].rmsd, 1e-6);
+            for (uint i=0; i<4; i++)
+                for (uint j=0; j<4; j++)
+                    TS_ASSERT_DELTA(matrices[16*m+4*i+j], reference[m].matrix(i,j), 1e-8);
+        }
+
+        models.pop_back();
+        TS_ASSERT_THROWS(sup.fit(models, matrices, rmsds), std::invalid_argument);
+    }
+
+    void testDegenerateFit()
+    {
+        //collinear atoms reversed: every half turn around an axis orthogonal to
+        //the line is optimal, the largest eigenvalue is double
+        for (dbl scale=1e-3; scale<2e3; scale*=1e3)
+        {
+            Rigidbody ref, mob;
+            Atomproperty prop;
+            for (int i=-2; i<=2; i++)
+            {
+                ref.AddAtom(prop, Coord3D(scale*i, 0.0, 0.0));
+                mob.AddAtom(prop, Coord3D(-scale*i, 0.0, 0.0));
+            }
+            Superpose_t sup = superpose(ref, mob);
+            Rigidbody fitted(mob);
+            fitted.ApplyMatrix(sup.matrix);
+            //the reported rmsd is the one of the returned matrix
+            TS_ASSERT_DELTA(sup.rmsd, Rmsd(ref, fitted), 1e-6*scale);
+        }
+    }
+
 };
 
 
@@ -312,6 +767,260 @@ Coord3D rdCoord(double a, double b)
     return Coord3D(x,y,z);
 }
 
+class TestMatrixRmsd: public CxxTest::TestSuite
+{
+public:
+
+    void testPoses()
+    {
+        Rigidbody lig("pk6c.red");
+        AtomSelection ca = lig.CA();
+        MatrixRmsd full(lig);
+        MatrixRmsd mca(ca);
+
+        std::vector<Matrix> poses;
+        std::vector<Rigidbody> moved;
+        for (uint i=0; i<4; i++)
+        {
+            Rigidbody r(lig);
+            r.AttractEulerRotate(0.4*i, -0.3*i, 0.2);
+            r.Translate(Coord3D(i, 2.0*i, -1.0));
+            poses.push_back(r.GetMatrix());
+            moved.push_back(r);
+        }
+
+        std::vector<dbl> all = full.allPairs(poses);
+        TS_ASSERT_EQUALS(all.size(), 16);
+        for (uint i=0; i<4; i++)
+            for (uint j=0; j<4; j++)
+            {
+                dbl ref = Rmsd(moved[i], moved[j]);
+                TS_ASSERT_DELTA(full.rmsd(poses[i], poses[j]), ref, 1e-8);
+                TS_ASSERT_DELTA(all[4*i+j], ref, 1e-8);
+                TS_ASSERT_DELTA(mca.rmsd(poses[i], poses[j]), Rmsd(moved[i].CA(), moved[j].CA()), 1e-8);
+            }
+    }
+
+    void testRmsdMatrix()
+    {
+        Rigidbody lig("pk6c.red");
+        Random random;
+        random.seed(7);
+
+        //more structures than a tile
+        std::vector<Rigidbody> structures;
+        for (uint i=0; i<37; i++)
+        {
+            Rigidbody r(lig);
+            for (uint k=0; k<r.Size(); k++)
+            {
+                Coord3D c = r.GetCoords(k);
+                c.x += random.random()-0.5;
+                r.SetCoords(k, c);
+            }
+            r.AttractEulerRotate(random.random(), random.random(), random.random());
+            r.Translate(Coord3D(random.random(), 5.0*random.random(), 0.0));
+            structures.push_back(r);
+        }
+
+        std::vector<dbl> plain = RmsdMatrix(structures);
+        std::vector<dbl> fitted = RmsdMatrix(structures, true);
+        TS_ASSERT_EQUALS(plain.size(), 37*36/2);
+        uint index = 0;
+        for (uint i=0; i<37; i++)
+            for (uint j=i+1; j<37; j++, index++)
+            {
+                TS_ASSERT_DELTA(plain[index], Rmsd(structures[i], structures[j]), 1e-9);
+                TS_ASSERT_DELTA(fitted[index], superpose(structures[i], structures[j]).rmsd, 1e-6);
+            }
+    }
+
+};
+
+
+
+class TestClustering: public CxxTest::TestSuite
+{
+public:
+
+    void testGreedyClustering()
+    {
+        Rigidbody lig("pk6c.red");
+        Random random;
+        random.seed(42);
+
+        PoseClustering clust(lig, 2.0);
+        std::vector<dbl> energies;
+        std::vector<Rigidbody> poses;
+        for (uint i=0; i<300; i++)
+        {
+            //poses around a few sites
+            Rigidbody r(lig);
+            uint site = i%5;
+            r.AttractEulerRotate(site + 0.1*random.random(), 0.1*random.random(), 0.1*random.random());
+            r.Translate(Coord3D(15.0*site + 3.0*random.random(), 3.0*random.random(), 3.0*random.random()));
+            dbl ener = -100.0*random.random();
+            TS_ASSERT_EQUALS(clust.AddPose(ener, r.GetMatrix()), i);
+            energies.push_back(ener);
+            poses.push_back(r);
+        }
+        clust.Run();
+
+        //reference: each pose joins the latest matching cluster
+        std::vector<uint> order;
+        for (uint i=0; i<300; i++) order.push_back(i);
+        for (uint i=0; i<300; i++)
+            for (uint j=i+1; j<300; j++)
+                if (energies[order[j]] < energies[order[i]]) std::swap(order[i], order[j]);
+        std::vector<uint> reps, sizes;
+        for (uint i=0; i<300; i++)
+        {
+            int found = -1;
+            for (int c=reps.size()-1; c>=0 && found<0; c--)
+                if (Rmsd(poses[order[i]], poses[reps[c]]) < 2.0) found = c;
+            if (found < 0) {reps.push_back(order[i]); sizes.push_back(1);}
+            else sizes[found]++;
+        }
+
+        TS_ASSERT(reps.size() > 5);
+        TS_ASSERT_EQUALS(clust.NbClusters(), reps.size());
+        for (uint c=0; c<reps.size() && c<clust.NbClusters(); c++)
+        {
+            TS_ASSERT_EQUALS(clust.GetRepresentative(c), reps[c]);
+            TS_ASSERT_EQUALS(clust.GetClusterSize(c), sizes[c]);
+        }
+        //the centers prune most of the comparisons
+        TS_ASSERT(clust.NbRmsdComputed() < 300*reps.size()/2);
+
+        clust.Run(10);
+        TS_ASSERT_EQUALS(clust.GetAssignments()[order[10]], -1);
+        TS_ASSERT_THROWS(PoseClustering(lig, 0.0), std::invalid_argument);
+        TS_ASSERT_THROWS(clust.AddPose(0.0, std::vector<dbl>(12)), std::invalid_argument);
+    }
+
+};
+
+
+
+class TestInterfaceEvaluator: public CxxTest::TestSuite
+{
+public:
+
+    /// residue contacts closer than 7A, as fnat.py
+    std::set<std::pair<uint,uint> > contacts(Rigidbody& rec, Rigidbody& lig)
+    {
+        std::set<std::pair<uint,uint> > res;
+        for (uint i=0; i<rec.Size(); i++)
+            for (uint j=0; j<lig.Size(); j++)
+                if (Norm2(rec.GetCoords(i) - lig.GetCoords(j)) <= 49.0)
+                    res.insert(std::make_pair(rec.GetAtomProperty(i).GetResidId(), lig.GetAtomProperty(j).GetResidId()));
+        return res;
+    }
+
+    /// backbones of the interface residues of lig (at the position of ligpose) and rec, found with a pairlist
+    void interfaceBackbone(Rigidbody& rec, Rigidbody& lig, dbl cutoff, Rigidbody& ligpose, Rigidbody& ligbb, Rigidbody& recbb)
+    {
+        AttractRigidbody arec(rec), alig(lig);
+        AttractPairList pl(arec, alig, cutoff);
+        std::set<uint> recres, ligres;
+        for (uint i=0; i<pl.Size(); i++)
+        {
+            recres.insert(rec.GetAtomProperty(pl[i].atrec).GetResidId());
+            ligres.insert(lig.GetAtomProperty(pl[i].atlig).GetResidId());
+        }
+        AtomSelection recsel, ligsel;
+        recsel.SetRigid(rec);
+        ligsel.SetRigid(ligpose);
+        for (std::set<uint>::const_iterator it=recres.begin(); it!=recres.end(); ++it)
+            recsel = recsel | rec.SelectResRange(*it, *it);
+        for (std::set<uint>::const_iterator it=ligres.begin(); it!=ligres.end(); ++it)
+            ligsel = ligsel | ligpose.SelectResRange(*it, *it);
+        recbb = (recsel & rec.Backbone()).CreateRigid();
+        ligbb = (ligsel & ligpose.Backbone()).CreateRigid();
+    }
+
+    void testPoses()
+    {
+        Rigidbody rec("pk6a.red");
+        Rigidbody ligref("pk6c.red");
+        InterfaceEvaluator eval(rec, ligref, 7.0, 14.0);
+
+        std::set<std::pair<uint,uint> > native = contacts(rec, ligref);
+        TS_ASSERT_EQUALS(eval.NbNativeContacts(), native.size());
+        TS_ASSERT_DELTA(eval.Fnat(ligref), 1.0, 1e-12);
+        TS_ASSERT_DELTA(eval.Irmsd(ligref), 0.0, 1e-12);
+        TS_ASSERT_DELTA(eval.Lrmsd(ligref), 0.0, 1e-12);
+
+        Random random;
+        random.seed(7);
+        std::vector<dbl> matrices;
+        std::vector<Rigidbody> poses;
+        for (uint i=0; i<20; i++)
+        {
+            Rigidbody r(ligref);
+            r.AttractEulerRotate(0.3*random.random(), 0.3*random.random(), 0.3*random.random());
+            r.Translate(Coord3D(4.0*random.random(), 4.0*random.random(), 4.0*random.random()));
+            Matrix m = r.GetMatrix();
+            for (uint j=0; j<16; j++) matrices.push_back(m(j/4, j%4));
+            poses.push_back(r);
+        }
+
+        std::vector<dbl> fnat, irmsd, lrmsd;
+        eval.Evaluate(matrices, fnat, irmsd, lrmsd);
+        TS_ASSERT_EQUALS(fnat.size(), 20u);
+
+        InterfaceEvaluator fitted(rec, ligref, 7.0, 14.0);
+        fitted.SetInterfaceSuperposition(true);
+        std::vector<dbl> fnat2, irmsd2, lrmsd2;
+        fitted.Evaluate(matrices, fnat2, irmsd2, lrmsd2);
+
+        for (uint i=0; i<20; i++)
+        {
+            std::set<std::pair<uint,uint> > found = contacts(rec, poses[i]);
+            uint common = 0;
+            for (std::set<std::pair<uint,uint> >::const_iterator it=native.begin(); it!=native.end(); ++it)
+                common += found.count(*it);
+            TS_ASSERT_DELTA(fnat[i], (dbl) common / native.size(), 1e-12);
+
+            TS_ASSERT_DELTA(lrmsd[i], Rmsd(ligref.Backbone(), poses[i].Backbone()), 1e-9);
+            TS_ASSERT_DELTA(irmsd[i], eval.Irmsd(poses[i]), 1e-9);
+            TS_ASSERT(irmsd[i] > 0.0 && irmsd[i] <= lrmsd[i]*3.0);
+
+            //reference: interface residues from a pairlist, then Rmsd and superpose
+            Rigidbody refbb, posebb, recbb;
+            interfaceBackbone(rec, ligref, 14.0, ligref, refbb, recbb);
+            interfaceBackbone(rec, ligref, 14.0, poses[i], posebb, recbb);
+            TS_ASSERT_EQUALS(refbb.Size() + recbb.Size(), eval.NbInterfaceAtoms());
+            TS_ASSERT_DELTA(irmsd[i], Rmsd(refbb, posebb), 1e-9);
+            TS_ASSERT_DELTA(irmsd2[i], superpose(refbb + recbb, posebb + recbb).rmsd, 1e-6);
+
+            //the superposition includes the fixed receptor interface
+            TS_ASSERT_DELTA(irmsd2[i], fitted.Irmsd(poses[i]), 1e-9);
+            TS_ASSERT(irmsd2[i] < irmsd[i]);
+            TS_ASSERT_EQUALS(fnat2[i], fnat[i]);
+        }
+
+        TS_ASSERT_THROWS(eval.SetLigand(rec), std::invalid_argument);
+        TS_ASSERT_THROWS(eval.Evaluate(std::vector<dbl>(12), fnat, irmsd, lrmsd), std::invalid_argument);
+    }
+
+    void testNoContact()
+    {
+        //no atom pair within 0.5A: no native contact, the I-RMSD is still defined
+        Rigidbody rec("pk6a.red");
+        Rigidbody ligref("pk6c.red");
+        InterfaceEvaluator eval(rec, ligref, 0.5, 14.0);
+        TS_ASSERT_EQUALS(eval.NbNativeContacts(), 0u);
+        Rigidbody pose(ligref);
+        pose.Translate(Coord3D(1.0, 0.0, 0.0));
+        TS_ASSERT_EQUALS(eval.Fnat(pose), 0.0);
+        TS_ASSERT_DELTA(eval.Irmsd(pose), 1.0, 1e-9);
+    }
+
+};
+
+
+
 class TestRot: public CxxTest::TestSuite
 {
 
@@ -407,10 +1116,712 @@ public:
 
 
 
+class TestEnergyKernel: public CxxTest::TestSuite
+{
+public:
+
+    void testEnergyOnly()
+    {
+        AttractRigidbody a(Rigidbody("pk6a.red"));
+        AttractRigidbody c(Rigidbody("pk6c.red"));
+        AttractForceField2 ff("mbest1k.par", 20.0);
+
+        AttractPairList pl(a, c, 20.0);
+        dbl ener = ff.nonbon8(a, c, pl);
+        TS_ASSERT( fabs(ff.nonbon8_energy(a, c, pl) - ener) < 1e-6 );
+
+        //pairs within the skin must not change the energy:
+        AttractPairList plskin(a, c, 20.0, 3.0);
+        TS_ASSERT( plskin.Size() >= pl.Size() );
+        TS_ASSERT( fabs(ff.nonbon8_energy(a, c, plskin) - ener) < 1e-6 );
+    }
+
+    void testSkinUpdate()
+    {
+        AttractRigidbody a(Rigidbody("pk6a.red"));
+        AttractRigidbody c(Rigidbody("pk6c.red"));
+        AttractPairList pl(a, c, 10.0, 2.0);
+
+        TS_ASSERT( !pl.needsUpdate() );
+        c.Translate(Coord3D(1.0, 0.0, 0.0));
+        TS_ASSERT( !pl.needsUpdate() );
+        c.Translate(Coord3D(1.5, 0.0, 0.0));
+        TS_ASSERT( pl.needsUpdate() );
+        TS_ASSERT( pl.updateIfNeeded() );
+        TS_ASSERT( !pl.needsUpdate() );
+
+        //any move of the receptor invalidates the list
+        a.Translate(Coord3D(0.0, 0.1, 0.0));
+        TS_ASSERT( pl.needsUpdate() );
+        TS_ASSERT( pl.updateIfNeeded() );
+        TS_ASSERT( !pl.needsUpdate() );
+
+        //without a skin the list is rebuilt every time
+        AttractPairList noskin(a, c, 10.0);
+        TS_ASSERT( noskin.needsUpdate() );
+    }
+
+    void testDesolvation()
+    {
+        AttractForceField2 ff("mbest1k.par", 20.0);
+        ff.SetDesolvation("../PyAttract/solv.dat");
+
+        //two atoms of type ALA (radius 1.9, parameter 0.021): each one buries a cap of the other
+        Atomproperty prop;
+        prop.SetExtra("    2   0.000");
+        Rigidbody r1, r2;
+        r1.AddAtom(prop, Coord3D(0, 0, 0));
+        r2.AddAtom(prop, Coord3D(4.0, 0, 0));
+        AttractRigidbody a1(r1), a2(r2);
+        AttractPairList pl(a1, a2, 20.0);
+        dbl R = 1.9 + 1.4;
+        dbl cap = 2*M_PI*R*(R - 2.0);
+        TS_ASSERT_DELTA(ff.desolvation(a1, a2, pl, 0, 0), -2*0.021*cap, 1e-6);
+        ff.SetDesolvationWeight(0.5);
+        TS_ASSERT_DELTA(ff.desolvation(a1, a2, pl, 0, 0), -0.021*cap, 1e-6);
+        TS_ASSERT_THROWS(ff.SetDesolvation("nofile.dat"), std::invalid_argument);
+    }
+
+    void testDesolvationDerivatives()
+    {
+        AttractRigidbody a(Rigidbody("pk6a.red"));
+        AttractRigidbody c(Rigidbody("pk6c.red"));
+        a.setTranslation(false);
+        a.setRotation(false);
+
+        AttractForceField2 ff("mbest1k.par", 20.0);
+        ff.AddLigand(a);
+        ff.AddLigand(c);
+        Vdouble x(6, 0.0);
+        x[0] = 0.02; x[1] = -0.01; x[2] = 0.015;
+        x[3] = 0.3; x[4] = -0.2; x[5] = 0.1;
+        dbl without = ff.Function(x);
+
+        ff.SetDesolvation("../PyAttract/solv.dat", 2.0);
+        dbl with = ff.Function(x);
+        TS_ASSERT( ff.getDesolv() != 0.0 );
+        TS_ASSERT_DELTA(with - without, ff.getDesolv(), 1e-6);
+
+        //finite differences
+        ff.SetDesolvationWeight(1.0);
+        Vdouble g(6, 0.0);
+        ff.Function(x);
+        ff.Derivatives(x, g);
+        dbl h = 1e-7;
+        for (uint i=0; i<6; i++)
+        {
+            Vdouble xp(x), xm(x);
+            xp[i] += h;
+            xm[i] -= h;
+            dbl num = (ff.Function(xp) - ff.Function(xm)) / (2.0*h);
+            TS_ASSERT_DELTA(g[i], num, 1e-3*std::max(1.0, fabs(num)));
+        }
+
+        //switched off for a coarse stage
+        ff.SetDesolvationWeight(0.0);
+        TS_ASSERT_DELTA(ff.Function(x), without, 1e-9);
+    }
+
+    void testDesolvationEnergy()
+    {
+        AttractRigidbody a(Rigidbody("pk6a.red"));
+        AttractRigidbody c(Rigidbody("pk6c.red"));
+        AttractPairList pl(a, c, 10.0);
+        AttractForceField2 ff("mbest1k.par", 10.0);
+        dbl without = ff.nonbon8_energy(a, c, pl);
+
+        //the energy-only and pairs paths (Monte Carlo, McopForceField) include the term
+        ff.SetDesolvation("../PyAttract/solv.dat", 2.0);
+        dbl desolv = ff.desolvation(a, c, pl, 0, 0);
+        TS_ASSERT( desolv != 0.0 );
+        TS_ASSERT_DELTA(ff.nonbon8_energy(a, c, pl), without + desolv, 1e-6);
+
+        //rows are indexed by their type column, not by their order
+        std::vector<std::string> lines;
+        std::ifstream solv("../PyAttract/solv.dat");
+        std::string line;
+        while (std::getline(solv, line)) lines.push_back(line);
+        std::ofstream shuffled("solv_shuffled.dat");
+        for (uint i=lines.size(); i>0; i--) shuffled << lines[i-1] << "\n";
+        shuffled.close();
+        ff.SetDesolvation("solv_shuffled.dat", 2.0);
+        TS_ASSERT_DELTA(ff.desolvation(a, c, pl, 0, 0), desolv, 1e-9);
+
+        std::vector<dbl> radius, param;
+        ReadSolvationParameters("solv_shuffled.dat", radius, param);
+        TS_ASSERT_DELTA(radius[1], 1.9, 1e-12); //type 2 (ALA)
+        TS_ASSERT_DELTA(param[1], 0.021, 1e-12);
+
+        std::ofstream twice("solv_shuffled.dat");
+        twice << lines[0] << "\n" << lines[1] << "\n" << lines[0] << "\n";
+        twice.close();
+        TS_ASSERT_THROWS(ReadSolvationParameters("solv_shuffled.dat", radius, param), std::invalid_argument);
+        std::ofstream missing("solv_shuffled.dat");
+        missing << lines[0] << "\n" << lines[2] << "\n";
+        missing.close();
+        TS_ASSERT_THROWS(ReadSolvationParameters("solv_shuffled.dat", radius, param), std::invalid_argument);
+
+        //atom types without parameters are reported before any (parallel) loop
+        std::ofstream truncated("solv_shuffled.dat");
+        truncated << lines[0] << "\n" << lines[1] << "\n" << lines[2] << "\n";
+        truncated.close();
+        ff.SetDesolvation("solv_shuffled.dat", 2.0);
+        TS_ASSERT_THROWS(ff.CheckDesolvationTypes(c), std::out_of_range);
+        TS_ASSERT_THROWS(ff.nonbon8(a, c, pl), std::out_of_range);
+        MonteCarlo mc(ff, a, 10.0);
+        TS_ASSERT_THROWS(mc.AddChain(c), std::out_of_range);
+        ff.SetDesolvationWeight(0.0);
+        ff.CheckDesolvationTypes(c);
+        remove("solv_shuffled.dat");
+    }
+
+};
+
+
+class TestMonteCarlo: public CxxTest::TestSuite
+{
+public:
+
+    void testRefinement()
+    {
+        AttractRigidbody a(Rigidbody("pk6a.red"));
+        AttractRigidbody c(Rigidbody("pk6c.red"));
+        AttractForceField2 ff("mbest1k.par", 10.0);
+
+        //start away from the crystal pose
+        c.Translate(Coord3D(2.0, -1.5, 1.0));
+        c.AttractEulerRotate(0.05, 0.1, -0.05);
+        AttractPairList startpl(a, c, 10.0);
+        dbl start = ff.nonbon8_energy(a, c, startpl);
+
+        MonteCarlo mc(ff, a, 10.0);
+        mc.AddChain(c);
+        mc.AddChain(c);
+        TS_ASSERT_DELTA( mc.GetEnergy(0), start, 1e-6 );
+        mc.SetTemperature(1.0, 0.1);
+        mc.Run(500);
+
+        for (uint i=0; i<mc.NbChains(); i++)
+        {
+            TS_ASSERT( mc.GetEnergy(i) < start - 1.0 );
+            //the best pose is consistent with the reported energy:
+            AttractRigidbody best = mc.GetLigand(i);
+            AttractPairList pl(a, best, 10.0);
+            TS_ASSERT( fabs(ff.nonbon8_energy(a, best, pl) - mc.GetEnergy(i)) < 1e-6 );
+        }
+        TS_ASSERT( mc.GetAcceptanceRate() > 0.0 );
+    }
+
+};
+
+
+
+class TestLbfgs: public CxxTest::TestSuite
+{
+public:
+
+    void testWarmStart()
+    {
+        AttractRigidbody a(Rigidbody("pk6a.red"));
+        AttractRigidbody c(Rigidbody("pk6c.red"));
+        a.setTranslation(false);
+        a.setRotation(false);
+
+        //first stage, stopped before convergence
+        AttractForceField2 ff1("mbest1k.par", 20.0);
+        ff1.AddLigand(a);
+        ff1.AddLigand(c);
+        Lbfgs first(ff1);
+        first.minimize(20);
+        TS_ASSERT( first.GetHistorySize() > 0 );
+
+        //second stage from the same point, without and with the history of the first one
+        AttractForceField2 ff2("mbest1k.par", 20.0);
+        ff2.AddLigand(a);
+        ff2.AddLigand(c);
+        Lbfgs cold(ff2);
+        cold.SetStartingPoint(first.GetMinimizedVars());
+        cold.minimize(500);
+
+        AttractForceField2 ff3("mbest1k.par", 20.0);
+        ff3.AddLigand(a);
+        ff3.AddLigand(c);
+        Lbfgs warm(ff3);
+        warm.SetStartingPoint(first.GetMinimizedVars());
+        warm.SetHistory(first);
+        warm.minimize(500);
+
+        TS_ASSERT( warm.GetNumberIter() < cold.GetNumberIter() );
+        std::vector<double> xcold = cold.GetMinimizedVars();
+        std::vector<double> xwarm = warm.GetMinimizedVars();
+        TS_ASSERT( fabs(ff3.Function(xwarm) - ff2.Function(xcold)) < 1e-3 );
+    }
+
+
+    void testBounds()
+    {
+        AttractRigidbody a(Rigidbody("pk6a.red"));
+        AttractRigidbody c(Rigidbody("pk6c.red"));
+        a.setTranslation(false);
+        a.setRotation(false);
+
+        AttractForceField2 ff("mbest1k.par", 20.0);
+        ff.AddLigand(a);
+        ff.AddLigand(c);
+        Lbfgs lbfgs(ff);
+        for (uint i=3; i<6; i++)
+            lbfgs.SetBounds(i, -0.1, 0.1);
+        TS_ASSERT_THROWS(lbfgs.SetBounds(0, 1.0, -1.0), std::invalid_argument);
+        TS_ASSERT_THROWS(lbfgs.SetLowerBound(6, 0.0), std::out_of_range);
+        TS_ASSERT_THROWS(lbfgs.SetLowerBound(3, 0.2), std::invalid_argument);
+        TS_ASSERT_THROWS(lbfgs.SetUpperBound(3, -0.2), std::invalid_argument);
+        lbfgs.SetUpperBound(0, 1.0);
+        TS_ASSERT_THROWS(lbfgs.SetLowerBound(0, 2.0), std::invalid_argument);
+        lbfgs.SetBounds(0, 2.0, 3.0); //both bounds at once
+        lbfgs.ClearBounds();
+        for (uint i=3; i<6; i++)
+            lbfgs.SetBounds(i, -0.1, 0.1);
+        lbfgs.minimize(100);
+
+        std::vector<double> x = lbfgs.GetMinimizedVars();
+        for (uint i=3; i<6; i++)
+            TS_ASSERT( x[i] >= -0.1 && x[i] <= 0.1 );
+    }
+
+
+    void testBoundsWarmStart()
+    {
+        //the history is injected as if all the variables were free, the
+        //variables at their bounds must then leave the free set
+        AttractRigidbody a(Rigidbody("pk6a.red"));
+        AttractRigidbody c(Rigidbody("pk6c.red"));
+        a.setTranslation(false);
+        a.setRotation(false);
+
+        AttractForceField2 ff1("mbest1k.par", 20.0);
+        ff1.AddLigand(a);
+        ff1.AddLigand(c);
+        Lbfgs first(ff1);
+        first.minimize(20);
+        std::vector<double> x0 = first.GetMinimizedVars();
+
+        //bounds around the end of the first stage, tight enough to be reached
+        AttractForceField2 ff2("mbest1k.par", 20.0);
+        ff2.AddLigand(a);
+        ff2.AddLigand(c);
+        Lbfgs cold(ff2);
+        AttractForceField2 ff3("mbest1k.par", 20.0);
+        ff3.AddLigand(a);
+        ff3.AddLigand(c);
+        Lbfgs warm(ff3);
+        warm.SetHistory(first);
+        for (uint i=0; i<6; i++)
+        {
+            cold.SetBounds(i, x0[i] - 0.02, x0[i] + 0.02);
+            warm.SetBounds(i, x0[i] - 0.02, x0[i] + 0.02);
+        }
+        cold.SetStartingPoint(x0);
+        warm.SetStartingPoint(x0);
+        cold.minimize(500);
+        warm.minimize(500);
+
+        std::vector<double> xcold = cold.GetMinimizedVars();
+        std::vector<double> xwarm = warm.GetMinimizedVars();
+        uint atbound = 0;
+        for (uint i=0; i<6; i++)
+        {
+            TS_ASSERT( xwarm[i] >= x0[i] - 0.02 && xwarm[i] <= x0[i] + 0.02 );
+            if (fabs(fabs(xcold[i] - x0[i]) - 0.02) < 1e-9) atbound++;
+        }
+        TS_ASSERT( atbound > 0 );
+        TS_ASSERT( fabs(ff3.Function(xwarm) - ff2.Function(xcold)) < 1e-3 );
+    }
+
+};
+
+
+
+class TestMcop: public CxxTest::TestSuite
+{
+public:
+
+    Rigidbody prot;
+    AttractRigidbody recmain, lig;
+    Region loop;
+
+    void setUp()
+    {
+        prot = Rigidbody("pk6a.red");
+        recmain = AttractRigidbody((!prot.SelectResRange(160, 169)).CreateRigid());
+        lig = AttractRigidbody(Rigidbody("pk6c.red"));
+
+        //three copies of the same loop, slightly shifted
+        AttractRigidbody copy(prot.SelectResRange(160, 169).CreateRigid());
+        loop = Region();
+        loop.addCopy(copy);
+        copy.Translate(Coord3D(0.5, 0.0, 0.0));
+        loop.addCopy(copy);
+        copy.Translate(Coord3D(-0.9, 0.3, 0.0));
+        loop.addCopy(copy);
+    }
+
+    void testSharedTransform()
+    {
+        Mcoprigid rec;
+        rec.setMain(recmain);
+        rec.addEnsemble(loop);
+
+        rec.AttractEulerRotate(0.3, -1.2, 2.0);
+        rec.Translate(Coord3D(3.0, -1.0, 2.5));
+
+        //copies are moved when accessed, on top of their own initial matrix
+        AttractRigidbody copy(loop[2]);
+        copy.AttractEulerRotate(0.3, -1.2, 2.0);
+        copy.Translate(Coord3D(3.0, -1.0, 2.5));
+        TS_ASSERT(Rmsd(rec.getCopy(0, 2), copy) < 1e-9);
+
+        AttractRigidbody main(recmain);
+        main.AttractEulerRotate(0.3, -1.2, 2.0);
+        main.Translate(Coord3D(3.0, -1.0, 2.5));
+        TS_ASSERT(Rmsd(rec.getMain(), main) < 1e-9);
+
+        rec.ResetMatrix();
+        TS_ASSERT(Rmsd(rec.getRegion(0)[2], loop[2]) < 1e-9);
+    }
+
+
+    void testFunction()
+    {
+        AttractForceField2 ff("mbest1k.par", 10.0);
+
+        Mcoprigid rec;
+        rec.setMain(recmain);
+        rec.addEnsemble(loop);
+        Mcoprigid mlig;
+        mlig.setMain(lig);
+
+        McopForceField mcop(ff, 10.0);
+        mcop.setReceptor(rec);
+        mcop.setLigand(mlig);
+        mcop.calculate_weights(mlig);
+
+        //reference: one pairlist and one evaluation per copy
+        std::vector<dbl> weights = mcop.getReceptorWeights()[0];
+        AttractPairList pl(recmain, lig, 10.0);
+        dbl ref = ff.nonbon8_energy(recmain, lig, pl);
+        for (uint i=0; i<loop.size(); i++)
+        {
+            AttractPairList cpl(loop[i], lig, 10.0);
+            ref += weights[i] * ff.nonbon8_energy(loop[i], lig, cpl);
+        }
+
+        Vdouble x(6, 0.0);
+        TS_ASSERT( fabs(mcop.Function(x) - ref) < 1e-6 );
+    }
+
+
+    void testCachedPairLists()
+    {
+        AttractForceField2 ff("mbest1k.par", 10.0);
+
+        Mcoprigid rec;
+        rec.setMain(recmain);
+        rec.addEnsemble(loop);
+        Mcoprigid mlig;
+        mlig.setMain(lig);
+
+        //pairlists with a skin, kept during the minimization, weights at every call
+        McopForceField cached(ff, 10.0, 2.0);
+        cached.setReceptor(rec);
+        cached.setLigand(mlig);
+        cached.setWeightsUpdate(1);
+        cached.initMinimization();
+
+        //pairlists rebuilt at every call
+        McopForceField fresh(ff, 10.0, 0.0);
+        fresh.setReceptor(rec);
+        fresh.setLigand(mlig);
+
+        Vdouble x(6, 0.0);
+        TS_ASSERT( fabs(cached.Function(x) - fresh.Function(x)) < 1e-6 );
+        x[3] = 0.7;
+        x[5] = -0.4;
+        TS_ASSERT( fabs(cached.Function(x) - fresh.Function(x)) < 1e-6 );
+    }
+
+
+    void testPrunedWeights()
+    {
+        AttractForceField2 ff("mbest1k.par", 10.0);
+
+        //copies buried in the ligand: energies far beyond exp() range
+        AttractRigidbody copy(prot.SelectResRange(160, 169).CreateRigid());
+        copy.Translate(lig.FindCenter() - copy.FindCenter());
+        Region buried;
+        for (uint i=0; i<3; i++)
+        {
+            buried.addCopy(copy);
+            copy.Translate(Coord3D(0.5, 0.0, 0.0));
+        }
+
+        Mcoprigid rec;
+        rec.setMain(recmain);
+        rec.addEnsemble(buried);
+        Mcoprigid mlig;
+        mlig.setMain(lig);
+
+        McopForceField mcop(ff, 10.0);
+        mcop.setReceptor(rec);
+        mcop.setLigand(mlig);
+        mcop.calculate_weights(mlig);
+
+        //lowest energy copy only, no nan
+        std::vector<dbl> weights = mcop.getReceptorWeights()[0];
+        TS_ASSERT_EQUALS(weights[0], 1.0);
+        TS_ASSERT_EQUALS(weights[1], 0.0);
+        TS_ASSERT_EQUALS(weights[2], 0.0);
+
+        //pruned copies do not contribute
+        AttractPairList pl(recmain, lig, 10.0);
+        AttractPairList cpl(buried[0], lig, 10.0);
+        dbl ref = ff.nonbon8_energy(recmain, lig, pl) + ff.nonbon8_energy(buried[0], lig, cpl);
+        Vdouble x(6, 0.0);
+        TS_ASSERT_DELTA(mcop.Function(x), ref, 1e-9*fabs(ref));
+
+        TS_ASSERT_THROWS(mcop.setWeightsThreshold(1.5), std::invalid_argument);
+    }
+
+
+    void testLigandCopies()
+    {
+        AttractForceField2 ff("mbest1k.par", 10.0);
+
+        //copies of a ligand fragment, receptor with its own copies of the loop
+        Rigidbody ligprot("pk6c.red");
+        AttractRigidbody ligmain((!ligprot.SelectResRange(199, 208)).CreateRigid());
+        AttractRigidbody ligcopy(ligprot.SelectResRange(199, 208).CreateRigid());
+        Region ligloop;
+        ligloop.addCopy(ligcopy);
+        ligcopy.Translate(Coord3D(0.0, 0.6, 0.0));
+        ligloop.addCopy(ligcopy);
+
+        Mcoprigid rec;
+        rec.setMain(recmain);
+        rec.addEnsemble(loop);
+        Mcoprigid mlig;
+        mlig.setMain(ligmain);
+        mlig.addEnsemble(ligloop);
+
+        McopForceField mcop(ff, 10.0);
+        mcop.setReceptor(rec);
+        mcop.setLigand(mlig);
+        mcop.calculate_weights(mlig);
+
+        std::vector<dbl> recweights = mcop.getReceptorWeights()[0];
+        std::vector<dbl> ligweights = mcop.getLigandWeights()[0];
+        std::vector<dbl> joint = mcop.getJointWeights(0, 0);
+        TS_ASSERT_EQUALS(joint.size(), loop.size()*ligloop.size());
+
+        AttractPairList pl(recmain, ligmain, 10.0);
+        dbl ref = ff.nonbon8_energy(recmain, ligmain, pl);
+        for (uint i=0; i<loop.size(); i++)
+        {
+            AttractPairList cpl(loop[i], ligmain, 10.0);
+            ref += recweights[i] * ff.nonbon8_energy(loop[i], ligmain, cpl);
+        }
+        for (uint j=0; j<ligloop.size(); j++)
+        {
+            AttractPairList cpl(recmain, ligloop[j], 10.0);
+            ref += ligweights[j] * ff.nonbon8_energy(recmain, ligloop[j], cpl);
+        }
+        dbl sumjoint = 0.0;
+        for (uint i=0; i<loop.size(); i++)
+            for (uint j=0; j<ligloop.size(); j++)
+            {
+                AttractPairList cpl(loop[i], ligloop[j], 10.0);
+                ref += joint[i*ligloop.size()+j] * ff.nonbon8_energy(loop[i], ligloop[j], cpl);
+                sumjoint += joint[i*ligloop.size()+j];
+            }
+        TS_ASSERT( fabs(sumjoint - 1.0) < 1e-9 );
+
+        Vdouble x(6, 0.0);
+        TS_ASSERT( fabs(mcop.Function(x) - ref) < 1e-6 );
+    }
+
+
+    void testDerivatives()
+    {
+        AttractForceField2 ff("mbest1k.par", 10.0);
+
+        Rigidbody ligprot("pk6c.red");
+        AttractRigidbody ligmain((!ligprot.SelectResRange(199, 208)).CreateRigid());
+        AttractRigidbody ligcopy(ligprot.SelectResRange(199, 208).CreateRigid());
+        Region ligloop;
+        ligloop.addCopy(ligcopy);
+        ligcopy.Translate(Coord3D(0.0, 0.6, 0.0));
+        ligloop.addCopy(ligcopy);
+
+        Mcoprigid rec;
+        rec.setMain(recmain);
+        rec.addEnsemble(loop);
+        Mcoprigid mlig;
+        mlig.setMain(ligmain);
+        mlig.addEnsemble(ligloop);
+
+        McopForceField mcop(ff, 10.0);
+        mcop.setReceptor(rec);
+        mcop.setLigand(mlig);
+        mcop.initMinimization();
+
+        Vdouble x(6, 0.0);
+        x[0] = 0.02; x[1] = -0.01; x[2] = 0.015;
+        x[3] = 0.3; x[4] = -0.2; x[5] = 0.1;
+
+        //weights are updated here, then kept for the finite differences
+        mcop.Function(x);
+        Vdouble g(6, 0.0);
+        mcop.Derivatives(x, g);
+
+        dbl h = 1e-7; //small step: no pair should cross the cutoff
+        for (uint i=0; i<6; i++)
+        {
+            Vdouble xp(x), xm(x);
+            xp[i] += h;
+            xm[i] -= h;
+            dbl num = (mcop.Function(xp) - mcop.Function(xm)) / (2.0*h);
+            TS_ASSERT_DELTA(g[i], num, 1e-3*std::max(1.0, fabs(num)));
+        }
+    }
+
+};
+
+
+class TestSurface: public CxxTest::TestSuite
+{
+public:
+
+    Rigidbody prot;
+
+    void setUp()
+    {
+        prot = Rigidbody("pk6a.red");
+    }
+
+    void testSurfpoint()
+    {
+        Surface surf(30, 30, "../PyAttract/solv.dat");
+
+        //reference values of the all-pairs neighbour search
+        Rigidbody grid = surf.surfpoint(prot, 1.4);
+        TS_ASSERT_EQUALS(grid.Size(), 43991);
+        Coord3D sum;
+        for (uint i=0; i<grid.Size(); i++)
+            sum += grid.GetCoords(i);
+        TS_ASSERT_DELTA(sum.x, 2102067.276974, 1e-4);
+        TS_ASSERT_DELTA(sum.y, 1542472.304657, 1e-4);
+        TS_ASSERT_DELTA(sum.z, 837666.531000, 1e-4);
+
+        surf.surfpointParams(5000, 15.0);
+        TS_ASSERT_EQUALS(surf.surfpoint(prot, 1.4).Size(), 6643);
+    }
+
+    void testSurfpointRaw()
+    {
+        Surface surf(30, 30, "../PyAttract/solv.dat");
+        Rigidbody grid = surf.surfpoint(prot, 1.4);
+
+        std::vector<Coord3D> points;
+        std::vector<uint> parents;
+        surf.surfpoint(prot, 1.4, points, parents);
+        TS_ASSERT_EQUALS(points.size(), grid.Size());
+        TS_ASSERT_EQUALS(parents.size(), grid.Size());
 
+        bool same = true;
+        for (uint i=0; i<points.size(); i++)
+        {
+            if (!(points[i] == grid.GetCoords(i))) same = false;
+            if (grid.GetAtomProperty(i).GetResidId() != prot.GetAtomProperty(parents[i]).GetResidId()) same = false;
+        }
+        TS_ASSERT(same);
+    }
 
+    void testOuterGrid()
+    {
+        Surface surf(30, 30, "../PyAttract/solv.dat");
+        AttractRigidbody lig("pk6c.red");
+        dbl rad = lig.Radius();
+        surf.surfpointParams(5000, rad);
+        Rigidbody grid = surf.surfpoint(prot, 1.4);
+
+        //reference values of the all-pairs implementations (same selection order)
+        Rigidbody outer = surf.outergrid(grid, prot, rad*rad);
+        TS_ASSERT_EQUALS(outer.Size(), 4201);
+        Rigidbody thinned = surf.removeclosest(outer, 10.0);
+        TS_ASSERT_EQUALS(thinned.Size(), 216);
+        Coord3D sum;
+        for (uint i=0; i<thinned.Size(); i++)
+            sum += thinned.GetCoords(i) * (i+1);
+        TS_ASSERT_DELTA(sum.x, 1032387.002686, 1e-4);
+        TS_ASSERT_DELTA(sum.y, 1008202.544029, 1e-4);
+        TS_ASSERT_DELTA(sum.z, 251031.512308, 1e-4);
+    }
 
+    void testSasa()
+    {
+        Surface surf(10, 10, "../PyAttract/solv.dat");
+        Atomproperty prop;
+        prop.SetExtra("    1   0.000");
+        const dbl R = 1.9 + 1.4;
+
+        //isolated sphere
+        Rigidbody single;
+        single.AddAtom(prop, Coord3D(0, 0, 0));
+        std::vector<dbl> area = surf.sasa(single);
+        TS_ASSERT_EQUALS(area.size(), 1);
+        TS_ASSERT_DELTA(area[0], 4*M_PI*R*R, 1e-6);
+
+        //two overlapping spheres: each one loses a spherical cap of height R-d/2
+        Rigidbody pair(single);
+        dbl d = 3.0;
+        pair.AddAtom(prop, Coord3D(d, 0, 0));
+        surf.setSasaPoints(2000);
+        area = surf.sasa(pair);
+        dbl expected = 4*M_PI*R*R - 2*M_PI*R*(R-d/2);
+        TS_ASSERT_DELTA(area[0], expected, 0.01*expected);
+        TS_ASSERT_DELTA(area[1], area[0], 1e-6);
+
+        TS_ASSERT_THROWS(surf.setSasaPoints(0), std::invalid_argument);
+    }
 
+    void testSasaInterface()
+    {
+        Surface surf(10, 10, "../PyAttract/solv.dat");
+        Rigidbody lig("pk6c.red");
+        std::vector<dbl> unbound = surf.sasa(prot);
+        std::vector<dbl> complex = surf.sasa(prot + lig);
+        std::vector<dbl> bound = surf.sasaInterface(prot, lig, unbound);
+        TS_ASSERT_EQUALS(bound.size(), prot.Size());
+
+        bool same = true;
+        uint changed = 0;
+        for (uint i=0; i<prot.Size(); i++)
+        {
+            if (fabs(bound[i] - complex[i]) > 1e-9) same = false;
+            if (bound[i] != unbound[i]) changed++;
+        }
+        TS_ASSERT(same);
+        TS_ASSERT(changed > 0);
 
+        TS_ASSERT_THROWS(surf.sasaInterface(prot, lig, std::vector<dbl>(3)), std::invalid_argument);
+    }
 
+    void testNeighbourLimit()
+    {
+        Surface surf(10, 10, "../PyAttract/solv.dat");
+        //no limit by default, explicit limit still honored
+        TS_ASSERT_THROWS_NOTHING(surf.surfpoint(prot, 1.4));
+        surf.surfpointParams(2, 0.0);
+        TS_ASSERT_THROWS_ANYTHING(surf.surfpoint(prot, 1.4));
+    }
 
+};
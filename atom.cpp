@@ -3,6 +3,7 @@
 
 #include "atom.h"
 #include "coord3d.h"
+#include "pdbio.h"
 
 using namespace std;
 
@@ -24,23 +25,10 @@ std::string Atom::ToString() const {
 //! convert an atom to a string in PDB format
 std::string Atom::ToPdbString() const
 {
-    char output[81];
-    const char* atomname = GetType().c_str();
-    const char* residName = GetResidType().c_str();
-    int residnumber = GetResidId();
-    const char* chainID = GetChainId().c_str();
-
-    int atomnumber = GetAtomId();
-
-    Coord3D coord = GetCoords();
-    double x = coord.x;
-    double y = coord.y;
-    double z = coord.z ;
-
-    snprintf(output,80,"ATOM  %5d  %-4s%3s %1s%4d    %8.3f%8.3f%8.3f%s\n",atomnumber,atomname,residName,chainID,residnumber,x,y,z,GetExtra().c_str());
-    output[79]='\n';
-    output[80]='\0';
-    return std::string(output);
+    //lines are limited to 80 characters, end of line included
+    std::string output;
+    AppendPDBLine(output, *this, GetCoords(), 79);
+    return output;
 }
 
 //! translate an atom with a Coord3D vector
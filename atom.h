@@ -20,6 +20,9 @@ private:
     uint mAtomId; ///< atom number
     dbl mAtomCharge; ///< charge of the atom
     std::string mExtra; ///< extra data
+    uint mAtomCategory; ///< Attract atom category (from the extra data)
+    dbl mAttractCharge; ///< Attract charge (from the extra data)
+    bool mAttractFields; ///< true if the category and charge were read from the extra data
 
 public:
     /// default constructor
@@ -32,6 +35,9 @@ public:
         mResidId=1;
         mAtomId=1;
         mAtomCharge=0.0;
+        mAtomCategory=0;
+        mAttractCharge=0.0;
+        mAttractFields=false;
     };
 
     /// return atom type (CA, CB, O, N...)
@@ -70,12 +76,24 @@ public:
     /// define atom ID (1, 2...)
     inline void SetAtomId(uint atomnumber) {mAtomId=atomnumber;};
 
-    /// set the extra data field
-    inline void SetExtra(std::string extra){mExtra=extra;};
+    /// set the extra data field (the Attract fields read from the previous one are reset)
+    inline void SetExtra(std::string extra){mExtra=extra; mAtomCategory=0; mAttractCharge=0.0; mAttractFields=false;};
 
     /// get the extra data field
     inline std::string GetExtra() const {return mExtra;};
 
+    /// define the Attract category and charge, as read from the extra data field by the file readers
+    inline void SetAttractFields(uint category, dbl charge) {mAtomCategory=category; mAttractCharge=charge; mAttractFields=true;};
+
+    /// true if the Attract category and charge of the extra data field are known (see SetAttractFields())
+    inline bool HasAttractFields() const {return mAttractFields;};
+
+    /// return the Attract category (1, 2...) read from the extra data field
+    inline uint GetAtomCategory() const {return mAtomCategory;};
+
+    /// return the Attract charge read from the extra data field (independent of GetAtomCharge())
+    inline dbl GetAttractCharge() const {return mAttractCharge;};
+
 };
 
 
@@ -33,6 +33,28 @@ AtomSelection::AtomSelection(const AtomSelection& oldsel)
 
 
 
+SelectionCoords AtomSelection::GetCoordsView() const
+{
+    SelectionCoords view;
+    view.size = (m_rigid == 0) ? 0 : Size();
+    view.coords = (view.size == 0) ? 0 : m_rigid->GetMovedCoords();
+    view.indices = (view.size == 0) ? 0 : &m_list[0];
+    return view;
+}
+
+
+Coord3D AtomSelection::FindCenter() const
+{
+    SelectionCoords view = GetCoordsView();
+    Coord3D center;
+    for (uint i=0; i<view.size; i++)
+        center += view[i];
+    if (view.size > 0) center = center / (dbl) view.size;
+    return center;
+}
+
+
+
 Rigidbody AtomSelection::CreateRigid()
 {
     Rigidbody newrigid;
@@ -13,6 +13,17 @@
 namespace PTools {
 
 
+/// coordinates of the atoms of a selection, gathered without copy. Valid until the rigidbody is moved
+struct SelectionCoords
+{
+    const Coord3D* coords; ///< coordinates of all the atoms of the rigidbody
+    const uint* indices; ///< atoms of the selection
+    uint size;
+
+    const Coord3D& operator[](uint i) const {return coords[indices[i]];};
+};
+
+
 class AtomSelection{
 
 private:
@@ -39,6 +50,9 @@ public:
           return m_rigid->CopyAtom(m_list[i]);}; 
 
     Atom CopyAtom(uint i) const {return m_rigid->CopyAtom(m_list[i]);}
+    Coord3D GetCoords(uint i) const {return m_rigid->GetCoords(m_list[i]);} ///< coordinates of the i-th atom
+    SelectionCoords GetCoordsView() const; ///< coordinates of all the atoms of the selection (no copy)
+    Coord3D FindCenter() const; ///< geometric center of the selected atoms
     void AddAtomIndex(uint i) {m_list.push_back(i);}; ///< adds an Atom index
     Rigidbody CreateRigid(); ///< makes a new rigidcopy (independant copy) from an AtomsSlection object.
 
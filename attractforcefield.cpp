@@ -1,7 +1,9 @@
 #include "attractforcefield.h"
+#include "surface.h"
 
 
 #include <fstream>
+#include <limits>
 #include <math.h>  //for fabs()
 #include <sstream> //for istringstream
 
@@ -96,22 +98,50 @@ dbl AttractForceField1::nonbon8_forces(AttractRigidbody& rec, AttractRigidbody&
     assert(forcerec.size() == rec.Size());
     assert(forcelig.size() == lig.Size());
 
+    //every pair of the list is used, even if it moved beyond the cutoff during the minimization
+    return nonbon8_kernel<true>(rec, lig, pairlist.ReceptorAtoms(), pairlist.LigandAtoms(), pairlist.Size(),
+                                std::numeric_limits<double>::infinity(), 1.0, &forcerec[0], &forcelig[0], m_vdw, m_elec);
+}
+
+
+dbl AttractForceField1::nonbon8_vdw_elec(AttractRigidbody& rec, AttractRigidbody& lig, const uint* atrec, const uint* atlig, uint npairs,
+                                         dbl squarecutoff, dbl weight, Coord3D* forcerec, Coord3D* forcelig) const
+{
+    dbl vdw, elec;
+    if (forcerec || forcelig)
+        return nonbon8_kernel<true>(rec, lig, atrec, atlig, npairs, squarecutoff, weight, forcerec, forcelig, vdw, elec);
+    return nonbon8_kernel<false>(rec, lig, atrec, atlig, npairs, squarecutoff, weight, 0, 0, vdw, elec);
+}
+
+
+///the non-bonded kernel of nonbon8_forces() and nonbon8_vdw_elec(). forcerec and forcelig are not used without 'forces'
+template <bool forces>
+dbl AttractForceField1::nonbon8_kernel(AttractRigidbody& rec, AttractRigidbody& lig, const uint* atrec, const uint* atlig, uint npairs,
+                                       dbl squarecutoff, dbl weight, Coord3D* forcerec, Coord3D* forcelig, dbl& vdw, dbl& elec) const
+{
+
     dbl sumLJ=0.0 ;
     dbl sumElectrostatic=0.0;
 
-
     //synchronize coordinates for using unsafeGetCoords
     rec.syncCoords();
     lig.syncCoords();
 
     Coord3D a, b;
 
-
-    for (uint iter=0; iter<pairlist.Size(); iter++)
+    for (uint iter=0; iter<npairs; iter++)
     {
+        uint ir = atrec[iter];
+        uint jl = atlig[iter];
 
-        uint ir = pairlist[iter].atrec;
-        uint jl = pairlist[iter].atlig;
+        lig.unsafeGetCoords(jl,a);
+        rec.unsafeGetCoords(ir,b);
+
+        Coord3D dx = a-b ;
+        dbl r2 = Norm2(dx);
+        if (r2 > squarecutoff) continue;
+        if (r2 < 0.001 ) r2=0.001;
+        dbl rr2 = 1.0/r2;
 
         uint rAtomCat = rec.getAtomTypeNumber(ir);
         uint lAtomCat = lig.getAtomTypeNumber(jl);
@@ -119,56 +149,33 @@ dbl AttractForceField1::nonbon8_forces(AttractRigidbody& rec, AttractRigidbody&
         assert(rAtomCat < m_rad.size());
         assert(lAtomCat < m_rad.size());
 
-
         dbl alen = m_ac[ rAtomCat ][ lAtomCat ];
         dbl rlen = m_rc[ rAtomCat ][ lAtomCat ];
 
-
-        lig.unsafeGetCoords(jl,a);
-        rec.unsafeGetCoords(ir,b);
-
-        Coord3D dx = a-b ;
-        dbl r2 = Norm2(dx);
-
-        if (r2 < 0.001 ) r2=0.001;
-        dbl rr2 = 1.0/r2;
-        dx = rr2*dx;
-
         dbl rr23 = rr2*rr2*rr2 ;
         dbl rep =  rlen*rr2 ;
         dbl vlj = (rep-alen)*rr23 ;
-
         sumLJ += vlj;
 
-        dbl fb = 6.0*vlj+2.0*(rep*rr23) ;
-        Coord3D fdb = fb*dx ;
-
-        //assign force to the atoms:
-        forcelig[jl] -= fdb ;
-        forcerec[ir] += fdb ;
-
-
-
         //electrostatic part:
-        dbl chargeR = rec.m_charge[ir];
-        dbl chargeL = lig.m_charge[jl];
-        dbl charge = chargeR * chargeL * (332.053986/20.0);
+        dbl charge = rec.m_charge[ir] * lig.m_charge[jl] * (332.053986/20.0);
+        dbl et = charge*rr2;
+        sumElectrostatic += et;
 
-        if (fabs(charge) > 0.0)
+        if (forces)
         {
+            dbl fb = 6.0*vlj+2.0*(rep*rr23)+2.0*et ;
+            dx = rr2*dx;
 
-            dbl et = charge*rr2;
-            sumElectrostatic+=et;
-
-            Coord3D fdb = (2.0*et)*dx;
-            forcelig[jl] -= fdb ;
-            forcerec[ir] += fdb ;
+            //weighted force:
+            Coord3D fdb = (weight*fb)*dx ;
+            if (forcelig) forcelig[jl] -= fdb ;
+            if (forcerec) forcerec[ir] += fdb ;
         }
     }
 
-    m_vdw = sumLJ;
-    m_elec = sumElectrostatic;
-
+    vdw = sumLJ;
+    elec = sumElectrostatic;
     return sumLJ + sumElectrostatic;
 }
 
@@ -180,6 +187,7 @@ dbl AttractForceField1::nonbon8_forces(AttractRigidbody& rec, AttractRigidbody&
 
 
 
+
 void BaseAttractForceField::initMinimization()
 {
     MakePairLists();
@@ -462,159 +470,166 @@ void BaseAttractForceField::Derivatives(const Vdouble& stateVars, Vdouble& delta
 
 /*! \brief Non bonded energy
 *
-*   translated from fortran file nonbon8.f
-*   TODO: add comments in the code, remove debug instructions
+*   translated from fortran file nonbon8.f, see nonbon8_kernel()
 */
 dbl AttractForceField2::nonbon8_forces(AttractRigidbody& rec, AttractRigidbody& lig, AttractPairList & pairlist, std::vector<Coord3D>& forcerec, std::vector<Coord3D>& forcelig, bool print)
 {
 
-    dbl enon = 0.0;
-    dbl epote = 0.0;
+    assert(forcerec.size() == rec.Size());
+    assert(forcelig.size() == lig.Size());
 
+    //every pair of the list is used, even if it moved beyond the cutoff during the minimization
+    dbl ener = nonbon8_kernel<true>(rec, lig, pairlist.ReceptorAtoms(), pairlist.LigandAtoms(), pairlist.Size(),
+                                    std::numeric_limits<double>::infinity(), 1.0, &forcerec[0], &forcelig[0], m_vdw, m_elec);
 
-    std::cout.precision(20);
+    if (print) std::cout << "vlj  coulomb: " << m_vdw << "  " << m_elec << "\n";
+    return ener;
+}
 
-    //synchronise coordinates to later use unsafeGetCoords (should be faster)
-    rec.syncCoords();
-    lig.syncCoords();
 
-    Coord3D a;
-    Coord3D b;
 
-    for (uint ik=0; ik<pairlist.Size(); ik++ )
-    {
-        AtomPair atpair = pairlist[ik];
+dbl AttractForceField2::nonbon8_vdw_elec(AttractRigidbody& rec, AttractRigidbody& lig, const uint* atrec, const uint* atlig, uint npairs,
+                                         dbl squarecutoff, dbl weight, Coord3D* forcerec, Coord3D* forcelig) const
+{
+    dbl vdw, elec;
+    if (forcerec || forcelig)
+        return nonbon8_kernel<true>(rec, lig, atrec, atlig, npairs, squarecutoff, weight, forcerec, forcelig, vdw, elec);
+    return nonbon8_kernel<false>(rec, lig, atrec, atlig, npairs, squarecutoff, weight, 0, 0, vdw, elec);
+}
 
 
-        uint i = atpair.atrec ;
-        uint j = atpair.atlig ;
-        uint ii=rec.m_atomTypeNumber[i];
-        uint jj=lig.m_atomTypeNumber[j];
 
-        assert(ii<31);
-        assert(jj<31);
-        dbl alen = m_params->ac[ii][jj];
-        dbl rlen = m_params->rc[ii][jj];
-        int ivor = m_params->ipon[ii][jj];
-        assert(ivor==1 || ivor==-1);
+///the non-bonded kernel of nonbon8_forces() and nonbon8_vdw_elec(). forcerec and forcelig are not used without 'forces'
+template <bool forces>
+dbl AttractForceField2::nonbon8_kernel(AttractRigidbody& rec, AttractRigidbody& lig, const uint* atrec, const uint* atlig, uint npairs,
+                                       dbl squarecutoff, dbl weight, Coord3D* forcerec, Coord3D* forcelig, dbl& vdw, dbl& elec) const
+{
 
+    dbl enon = 0.0;
+    dbl epote = 0.0;
 
-        dbl charge= rec.m_charge[i]* lig.m_charge[j];  //charge product of the two atoms
-        //std::cout << "charge: " << charge << std::endl;
+    //synchronise coordinates to later use unsafeGetCoords (should be faster)
+    rec.syncCoords();
+    lig.syncCoords();
 
-        rec.unsafeGetCoords(i,a); lig.unsafeGetCoords(j,b);
+    Coord3D a, b;
 
-        Coord3D dx  ( a-b ) ;
+    for (uint ik=0; ik<npairs; ik++ )
+    {
+        uint i = atrec[ik] ;
+        uint j = atlig[ik] ;
 
+        rec.unsafeGetCoords(i,a); lig.unsafeGetCoords(j,b);
 
+        Coord3D dx ( a-b ) ;
         dbl r2 = Norm2(dx);
+        if (r2 > squarecutoff) continue;
         if (r2 < 0.001) r2=0.001 ;
-
         dbl rr2 = 1.0/r2;
-        dx = rr2*dx ;
 
-        if (charge != 0.0) {
-            dbl et = charge*rr2;
-            et*=(332.053986/15.0);  //constant felec/permi (could still be optimized!)
+        uint ii=rec.m_atomTypeNumber[i];
+        uint jj=lig.m_atomTypeNumber[j];
+        assert(ii<31);
+        assert(jj<31);
 
-            epote += et ;
-            Coord3D fdb =2.0*et*dx ;
-            forcelig[j] += fdb;
-            forcerec[i] -= fdb;
+        dbl fb = 0.0;
 
+        dbl charge= rec.m_charge[i]* lig.m_charge[j];  //charge product of the two atoms
+        if (charge != 0.0) {
+            dbl et = charge*rr2*(332.053986/15.0);  //constant felec/permi
+            epote += et ;
+            fb += 2.0*et;
         }
 
+        dbl rr23 = rr2*rr2*rr2 ;
+        dbl rep = m_params->rc[ii][jj]*rr2 ;
+        dbl vlj = (rep - m_params->ac[ii][jj])*rr23 ;
+
         //switch between minimum or saddle point
+        int ivor = m_params->ipon[ii][jj];
+        assert(ivor==1 || ivor==-1);
         if (r2 < m_params->rmin2[ii][jj] ) {
-
-            dbl rr23 = rr2*rr2*rr2 ;
-            dbl rep = rlen*rr2 ;
-            dbl vlj = (rep-alen)*rr23;
-            enon=enon+vlj+(ivor-1)*m_params->emin[ii][jj] ;
-
-            dbl fb=6.0*vlj+2.0*(rep*rr23);
-            Coord3D fdb = fb*dx;
-            forcelig[j]+=fdb;
-            forcerec[i]-=fdb;
+            enon += vlj+(ivor-1)*m_params->emin[ii][jj] ;
+            if (forces) fb += 6.0*vlj+2.0*(rep*rr23);
         }
         else {
-            dbl rr23=rr2*rr2*rr2;
-            dbl rep=rlen*rr2;
-            dbl vlj=(rep-alen)*rr23 ;
             enon += ivor*vlj ;
-
-            dbl fb=6.0*vlj+2.0*(rep*rr23);
-
-            Coord3D fdb=ivor*fb*dx ;
-            forcelig[j] += fdb ;
-            forcerec[i] -= fdb ;
+            if (forces) fb += ivor*(6.0*vlj+2.0*(rep*rr23));
         }
 
+        if (forces)
+        {
+            dx = rr2*dx ;
 
+            //weighted force:
+            Coord3D fdb = (weight*fb)*dx;
+            if (forcelig) forcelig[j] += fdb ;
+            if (forcerec) forcerec[i] -= fdb ;
+        }
     }
 
-    if (print) std::cout << "vlj  coulomb: " << enon << "  " << epote << "\n";
-    m_elec = epote;
-    m_vdw = enon;
+    vdw = enon;
+    elec = epote;
     return enon+epote;
 }
 
 
 
-void BaseAttractForceField::Trans(uint molIndex, Vdouble & delta, uint shift,  bool print)
-{
-// molIndex is the index of the protein we want to extract the average
-// translational forces
-
 
-    AttractRigidbody const & rig(m_movedligand[molIndex]);
-//   In this subroutine the translational force components are calculated
-    dbl flim = 1.0e18;
-    dbl ftr1, ftr2, ftr3, fbetr;
 
-    ftr1=0.0;
-    ftr2=0.0;
-    ftr3=0.0;
+void BaseAttractForceField::addTransForces(const AttractRigidbody& rig, Vdouble& delta, uint shift)
+{
+    assert(shift+2 < delta.size());
     for (uint i=0;i<rig.Size(); i++)
     {
-        ftr1=ftr1 + rig.m_forces[i].x;
-        ftr2=ftr2 + rig.m_forces[i].y;
-        ftr3=ftr3 + rig.m_forces[i].z;
+        delta[0+shift] += rig.m_forces[i].x;
+        delta[1+shift] += rig.m_forces[i].y;
+        delta[2+shift] += rig.m_forces[i].z;
     }
+}
+
+
+void BaseAttractForceField::reduceTransForces(Vdouble& delta, uint shift)
+{
+    dbl flim = 1.0e18;
+    dbl fbetr;
 
 // force reduction, some times helps in case of very "bad" start structure
     for (uint i=0; i<3; i++)
     {
-        fbetr=ftr1*ftr1 +ftr2*ftr2 +ftr3*ftr3;
+        fbetr=delta[shift]*delta[shift] + delta[shift+1]*delta[shift+1] + delta[shift+2]*delta[shift+2];
         if (fbetr > flim)
         {
-            ftr1=.01*ftr1;
-            ftr2=.01*ftr2;
-            ftr3=.01*ftr3;
+            delta[shift]=.01*delta[shift];
+            delta[shift+1]=.01*delta[shift+1];
+            delta[shift+2]=.01*delta[shift+2];
         }
     }
-
-    assert(shift+2 < delta.size());
-    delta[0+shift]=ftr1;
-    delta[1+shift]=ftr2;
-    delta[2+shift]=ftr3;
-
-    //debug:
-    if (print) std::cout <<  "translational forces: " << ftr1 <<"  "<< ftr2 <<"  " << ftr3 << std::endl;
-    return ;
 }
 
 
-
-void BaseAttractForceField::Rota(uint molIndex, dbl phi,dbl ssi, dbl rot, Vdouble & delta,uint shift, bool print)
+void BaseAttractForceField::Trans(uint molIndex, Vdouble & delta, uint shift,  bool print)
 {
 // molIndex is the index of the protein we want to extract the average
 // translational forces
 
+//   In this subroutine the translational force components are calculated
+    assert(shift+2 < delta.size());
+    for (uint i=0; i<3; i++)
+        delta[i+shift]=0.0;
 
+    addTransForces(m_movedligand[molIndex], delta, shift);
+    reduceTransForces(delta, shift);
+
+    //debug:
+    if (print) std::cout <<  "translational forces: " << delta[shift] <<"  "<< delta[shift+1] <<"  " << delta[shift+2] << std::endl;
+    return ;
+}
 
-    //delta array of dbls of dimension 6 ( 3 rotations, 3 translations)
 
+
+void BaseAttractForceField::addRotaForces(const AttractRigidbody& centered, const AttractRigidbody& moved, dbl phi, dbl ssi, dbl rot, Vdouble& delta, uint shift)
+{
     dbl  cs,cp,ss,sp,cscp,sscp,sssp,crot,srot,xar,yar,cssp,X,Y,Z ;
     dbl  pm[3][3];
 
@@ -625,14 +640,6 @@ void BaseAttractForceField::Rota(uint molIndex, dbl phi,dbl ssi, dbl rot, Vdoubl
 // !c     component 3: rot-angle
 // !c
 
-
-    for (uint i=0; i<3;i++)
-    {
-        delta[i+shift]=0.0;
-        for (uint j=0;j<3;j++)
-            pm[i][j]=0.0 ;
-    }
-
     cs=cos(ssi);
     cp=cos(phi);
     ss=sin(ssi);
@@ -647,15 +654,12 @@ void BaseAttractForceField::Rota(uint molIndex, dbl phi,dbl ssi, dbl rot, Vdoubl
     // for the x, y and z coordinates, we need
     // the coordinates of the centered, non-translated molecule
 
-    AttractRigidbody * pLigCentered = & m_centeredligand[molIndex] ; // pointer to the centered ligand
-    AttractRigidbody * pLigMoved  = & m_movedligand[molIndex] ; // pointer to the rotated/translated ligand (for forces)
-
     assert(shift+2 < delta.size());
-    for (uint i=0; i< pLigCentered->m_activeAtoms.size(); i++)
+    for (uint i=0; i< centered.m_activeAtoms.size(); i++)
     {
-        uint atomIndex = pLigCentered->m_activeAtoms[i];
+        uint atomIndex = centered.m_activeAtoms[i];
 
-        Coord3D coords = pLigCentered->GetCoords(atomIndex);
+        Coord3D coords = centered.GetCoords(atomIndex);
         X = coords.x;
         Y = coords.y;
         Z = coords.z;
@@ -676,11 +680,26 @@ void BaseAttractForceField::Rota(uint molIndex, dbl phi,dbl ssi, dbl rot, Vdoubl
 
         for (uint j=0;j<3;j++)
         {
-            delta[j+shift] += pm[0][j] * pLigMoved->m_forces[atomIndex].x ;
-            delta[j+shift] += pm[1][j] * pLigMoved->m_forces[atomIndex].y ;
-            delta[j+shift] += pm[2][j] * pLigMoved->m_forces[atomIndex].z ;
+            delta[j+shift] += pm[0][j] * moved.m_forces[atomIndex].x ;
+            delta[j+shift] += pm[1][j] * moved.m_forces[atomIndex].y ;
+            delta[j+shift] += pm[2][j] * moved.m_forces[atomIndex].z ;
         }
     }
+}
+
+
+void BaseAttractForceField::Rota(uint molIndex, dbl phi,dbl ssi, dbl rot, Vdouble & delta,uint shift, bool print)
+{
+// molIndex is the index of the protein we want to extract the average
+// rotational forces
+
+    //delta array of dbls of dimension 6 ( 3 rotations, 3 translations)
+
+    assert(shift+2 < delta.size());
+    for (uint i=0; i<3;i++)
+        delta[i+shift]=0.0;
+
+    addRotaForces(m_centeredligand[molIndex], m_movedligand[molIndex], phi, ssi, rot, delta, shift);
 
     if (print) std::cout << "Rotational forces: " << delta[shift] << " " << delta[shift+1] << " " << delta[shift+2] << std::endl;
 
@@ -726,6 +745,91 @@ void BaseAttractForceField::MakePairLists()
 AttractRigidbody BaseAttractForceField::GetLigand(uint i) {return m_movedligand[i];};
 
 
+void BaseAttractForceField::SetDesolvation(const std::string& solvfile, dbl weight, dbl probe)
+{
+    ReadSolvationParameters(solvfile, m_solvradius, m_solvparam);
+    for (uint t=0; t<m_solvradius.size(); t++)
+        m_solvradius[t] += probe;
+
+    m_desolvweight = weight;
+}
+
+
+void BaseAttractForceField::CheckDesolvationTypes(const AttractRigidbody& body) const
+{
+    if (m_desolvweight == 0.0) return;
+    for (uint i=0; i<body.Size(); i++)
+        if (body.getAtomTypeNumber(i) >= m_solvradius.size())
+            throw std::out_of_range("BaseAttractForceField::CheckDesolvationTypes: atom type without solvation parameters");
+}
+
+
+dbl BaseAttractForceField::desolvation(AttractRigidbody& rec, AttractRigidbody& lig, AttractPairList& pairlist, Coord3D* forcerec, Coord3D* forcelig) const
+{
+    return desolvation(rec, lig, pairlist.ReceptorAtoms(), pairlist.LigandAtoms(), pairlist.Size(),
+                       std::numeric_limits<double>::infinity(), 1.0, forcerec, forcelig);
+}
+
+
+dbl BaseAttractForceField::desolvation(AttractRigidbody& rec, AttractRigidbody& lig, const uint* atrec, const uint* atlig, uint npairs,
+                                       dbl squarecutoff, dbl weight, Coord3D* forcerec, Coord3D* forcelig) const
+{
+    const dbl pi = 3.141592654;
+    dbl ener = 0.0;
+
+    rec.syncCoords();
+    lig.syncCoords();
+
+    Coord3D a, b;
+    for (uint iter=0; iter<npairs; iter++)
+    {
+        uint ir = atrec[iter];
+        uint jl = atlig[iter];
+
+        uint rAtomCat = rec.getAtomTypeNumber(ir);
+        uint lAtomCat = lig.getAtomTypeNumber(jl);
+        //no throw here (OpenMP regions): see CheckDesolvationTypes()
+        if (rAtomCat >= m_solvradius.size() || lAtomCat >= m_solvradius.size()) continue;
+
+        dbl Rr = m_solvradius[rAtomCat];
+        dbl Rl = m_solvradius[lAtomCat];
+        dbl sum = Rr + Rl;
+
+        lig.unsafeGetCoords(jl,a);
+        rec.unsafeGetCoords(ir,b);
+        Coord3D dx = a-b;
+        dbl r2 = Norm2(dx);
+        if (r2 >= sum*sum || r2 > squarecutoff) continue;
+
+        dbl sr = m_solvparam[rAtomCat];
+        dbl sl = m_solvparam[lAtomCat];
+        dbl diff = Rl - Rr;
+        dbl r = sqrt(r2);
+
+        if (r <= fabs(diff))
+        {
+            //the smaller sphere is completely buried
+            ener -= (diff > 0.0) ? sr*4.0*pi*Rr*Rr : sl*4.0*pi*Rl*Rl;
+            continue;
+        }
+
+        //caps: b_rl = pi Rr (sum - diff - r + sum*diff/r), b_lr the same with -diff
+        dbl rr = 1.0/r;
+        ener -= sr*pi*Rr*(sum - diff - r + sum*diff*rr) + sl*pi*Rl*(sum + diff - r - sum*diff*rr);
+
+        if (forcerec || forcelig)
+        {
+            dbl dedr = sr*pi*Rr*(1.0 + sum*diff*rr*rr) + sl*pi*Rl*(1.0 - sum*diff*rr*rr);
+            Coord3D fdb = (weight*m_desolvweight*dedr*rr)*dx;
+            if (forcelig) forcelig[jl] += fdb;
+            if (forcerec) forcerec[ir] -= fdb;
+        }
+    }
+
+    return m_desolvweight*ener;
+}
+
+
 void AttractForceField2::setDummyTypeList(AttractRigidbody& lig)
 {
     lig.setDummyTypes(m_params->_dummytypes);
@@ -19,6 +19,8 @@ class BaseAttractForceField: public ForceField
 
 public:
 
+    BaseAttractForceField(): m_desolvweight(0.0), m_desolv(0.0) {};
+
     ///called before every minimization by the minimizer (Lbfgs)
     virtual void initMinimization();
     ///analytical derivative
@@ -42,6 +44,13 @@ public:
         std::vector<Coord3D> forceslig (lig.Size());
 
         dbl ener = nonbon8_forces(rec, lig, pairlist, forcesrec, forceslig, print);
+        if (m_desolvweight != 0.0)
+        {
+            CheckDesolvationTypes(rec);
+            CheckDesolvationTypes(lig);
+            m_desolv = desolvation(rec, lig, pairlist, &forcesrec[0], &forceslig[0]);
+            ener += m_desolv;
+        }
         rec.addForces(forcesrec);
         lig.addForces(forceslig);
         return ener;
@@ -50,6 +59,44 @@ public:
     ///non-bonded interactions, forces are returned separately
     virtual dbl nonbon8_forces(AttractRigidbody& rec, AttractRigidbody& lig, AttractPairList & pairlist, std::vector<Coord3D>& forcerec, std::vector<Coord3D>& forcelig, bool print=false)=0;
 
+    /*! \brief non-bonded energy only (no forces, no allocation)
+    *
+    *   pairs further than the pairlist cutoff are skipped, so that the energy only
+    *   depends on the current coordinates (pairlists with a skin may be used).
+    *   This function does not modify the forcefield and may be called from several
+    *   threads as long as the rigidbodies are synchronized (syncCoords()) beforehand.
+    */
+    dbl nonbon8_energy(AttractRigidbody& rec, AttractRigidbody& lig, AttractPairList & pairlist) const
+    {
+        return nonbon8_pairs(rec, lig, pairlist.ReceptorAtoms(), pairlist.LigandAtoms(), pairlist.Size(),
+                             pairlist.GetSquareCutoff(), 1.0, 0, 0);
+    }
+
+    /*! \brief weighted non-bonded interactions over arrays of atom pairs
+    *
+    *   pair k is (atrec[k], atlig[k]), pairs with r^2 > squarecutoff are skipped.
+    *   The forces multiplied by 'weight' are added to forcerec and forcelig
+    *   (NULL: not computed). Returns the unweighted energy, including the
+    *   desolvation term when it is switched on (see SetDesolvation()).
+    *   This function does not modify the forcefield.
+    */
+    dbl nonbon8_pairs(AttractRigidbody& rec, AttractRigidbody& lig, const uint* atrec, const uint* atlig, uint npairs,
+                      dbl squarecutoff, dbl weight, Coord3D* forcerec, Coord3D* forcelig) const
+    {
+        dbl ener = nonbon8_vdw_elec(rec, lig, atrec, atlig, npairs, squarecutoff, weight, forcerec, forcelig);
+        if (m_desolvweight != 0.0)
+            ener += desolvation(rec, lig, atrec, atlig, npairs, squarecutoff, weight, forcerec, forcelig);
+        return ener;
+    }
+
+    /*! \brief van der Waals and electrostatic terms of nonbon8_pairs()
+    *
+    *   nonbon8_forces() uses the same kernel without cutoff: all the pairs of the
+    *   pairlist are used.
+    */
+    virtual dbl nonbon8_vdw_elec(AttractRigidbody& rec, AttractRigidbody& lig, const uint* atrec, const uint* atlig, uint npairs,
+                                 dbl squarecutoff, dbl weight, Coord3D* forcerec, Coord3D* forcelig) const =0;
+
     virtual ~BaseAttractForceField(){};
 
 
@@ -59,12 +106,52 @@ public:
     ///rotational derivatives
     void Rota(uint molIndex, dbl phi, dbl ssi, dbl rot, Vdouble& delta, uint shift, bool print=false);
 
+    ///adds the sum of the forces on rig to delta[shift..shift+2]
+    static void addTransForces(const AttractRigidbody& rig, Vdouble& delta, uint shift);
+    ///scales down huge translational forces (bad starting structures)
+    static void reduceTransForces(Vdouble& delta, uint shift);
+    ///adds the derivatives wrt the euler angles of the forces on 'moved', 'centered' being the same body before rotation
+    static void addRotaForces(const AttractRigidbody& centered, const AttractRigidbody& moved, dbl phi, dbl ssi, dbl rot, Vdouble& delta, uint shift);
+
     ///return van der waals energy
     dbl getVdw(){return m_vdw;}
 
     ///coulomb (electrostatic) energy
     dbl getCoulomb(){return m_elec;}
 
+    /*! \brief pairwise desolvation term
+    *
+    *   reads the radii and solvation parameters (kcal/mol/A^2) of each atom type
+    *   from a file like solv.dat (see ReadSolvationParameters()), and adds the
+    *   weighted desolvation() to nonbon8(), nonbon8_energy() and nonbon8_pairs().
+    *   A weight of 0 (default) switches the term off, for instance for coarse stages.
+    */
+    void SetDesolvation(const std::string& solvfile, dbl weight=1.0, dbl probe=1.4);
+    void SetDesolvationWeight(dbl weight){m_desolvweight = weight;};
+    dbl GetDesolvationWeight() const {return m_desolvweight;};
+
+    /*! \brief weighted desolvation energy of the pairs of the pairlist
+    *
+    *   the surface of atom i (radius + probe) buried by atom j is the spherical cap
+    *   b_ij = pi R_i (R_i+R_j-d) (1+(R_j-R_i)/d) of the pairwise SASA approximation,
+    *   each buried area costs -sigma_i b_ij. Forces (NULL: not computed) are added.
+    */
+    dbl desolvation(AttractRigidbody& rec, AttractRigidbody& lig, AttractPairList& pairlist, Coord3D* forcerec, Coord3D* forcelig) const;
+    ///same over arrays of atom pairs, as nonbon8_pairs()
+    dbl desolvation(AttractRigidbody& rec, AttractRigidbody& lig, const uint* atrec, const uint* atlig, uint npairs,
+                    dbl squarecutoff, dbl weight, Coord3D* forcerec, Coord3D* forcelig) const;
+
+    /*! \brief throws std::out_of_range if desolvation is on and an atom type of
+    *   'body' has no solvation parameters.
+    *
+    *   desolvation() skips such pairs without error (it may run in OpenMP regions):
+    *   callers check their bodies once beforehand (nonbon8(), MonteCarlo, McopForceField).
+    */
+    void CheckDesolvationTypes(const AttractRigidbody& body) const;
+
+    ///desolvation energy of the last call to nonbon8()
+    dbl getDesolv(){return m_desolv;}
+
 
 
 protected:
@@ -79,6 +166,11 @@ protected:
     dbl m_vdw; ///< van der waals energy
     dbl m_elec; ///< electrostatic energy
 
+    std::vector<dbl> m_solvradius; ///< radius + probe of each atom type
+    std::vector<dbl> m_solvparam; ///< solvation parameter of each atom type
+    dbl m_desolvweight; ///< weight of the desolvation term (0: off)
+    dbl m_desolv; ///< desolvation energy
+
 
     
 
@@ -101,6 +193,8 @@ public:
     void InitParams(const std::string & paramsFileName);
     AttractForceField1(std::string paramsFileName, dbl cutoff);
     dbl nonbon8_forces(AttractRigidbody& rec, AttractRigidbody& lig, AttractPairList & pairlist, std::vector<Coord3D>& forcerec, std::vector<Coord3D>& forcelig, bool print=false);
+    dbl nonbon8_vdw_elec(AttractRigidbody& rec, AttractRigidbody& lig, const uint* atrec, const uint* atlig, uint npairs,
+                         dbl squarecutoff, dbl weight, Coord3D* forcerec, Coord3D* forcelig) const;
 
     virtual ~AttractForceField1(){};
 private:
@@ -118,6 +212,10 @@ private:
 
     dbl m_rstk;
 
+    template <bool forces>
+    dbl nonbon8_kernel(AttractRigidbody& rec, AttractRigidbody& lig, const uint* atrec, const uint* atlig, uint npairs,
+                       dbl squarecutoff, dbl weight, Coord3D* forcerec, Coord3D* forcelig, dbl& vdw, dbl& elec) const;
+
     void setDummyTypeList(AttractRigidbody& lig){std::vector<uint> dummytypes; lig.setDummyTypes(dummytypes);}; //forcefield1 has no dummy type
 };
 
@@ -200,6 +298,8 @@ public:
 
     AttractForceField2(const std::string & paramsFileName, dbl cutoff);
     dbl nonbon8_forces(AttractRigidbody& rec, AttractRigidbody& lig, AttractPairList & pairlist, std::vector<Coord3D>& forcerec, std::vector<Coord3D>& forcelig, bool print=false);
+    dbl nonbon8_vdw_elec(AttractRigidbody& rec, AttractRigidbody& lig, const uint* atrec, const uint* atlig, uint npairs,
+                         dbl squarecutoff, dbl weight, Coord3D* forcerec, Coord3D* forcelig) const;
 
     ///allows to reload a file of parameters
     void reloadParams(const std::string & filename, dbl cutoff);
@@ -209,6 +309,9 @@ private:
 
     void resetParams();
     void loadParams(const std::string & filename, dbl cutoff);
+    template <bool forces>
+    dbl nonbon8_kernel(AttractRigidbody& rec, AttractRigidbody& lig, const uint* atrec, const uint* atlig, uint npairs,
+                       dbl squarecutoff, dbl weight, Coord3D* forcerec, Coord3D* forcelig, dbl& vdw, dbl& elec) const;
 
     virtual void setDummyTypeList(AttractRigidbody& lig);
     std::string m_filename;   ///< name of parameter file
@@ -48,10 +48,18 @@ void AttractRigidbody::init_()
     for (uint i = 0; i < Size() ; ++i)
     {
         Atomproperty & at (mAtomProp[i]);
-        std::string extra = at.GetExtra();
-
-        std::istringstream iss( extra );
-        iss >> atcategory >> atcharge ;
+        if (at.HasAttractFields())
+        {
+            //already read by the file reader
+            atcategory = at.GetAtomCategory();
+            atcharge = at.GetAttractCharge();
+        }
+        else
+        {
+            std::string extra = at.GetExtra();
+            std::istringstream iss( extra );
+            iss >> atcategory >> atcharge ;
+        }
         m_atomTypeNumber.push_back(atcategory-1);  // -1 to directly use the atomTypeNumber into C-array
         m_charge.push_back(atcharge);
 
@@ -61,6 +69,7 @@ void AttractRigidbody::init_()
     setTranslation(true);
 
     resetForces();
+    updateActiveList(); //every atom is active until dummy types are set
 }
 
 
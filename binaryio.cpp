@@ -0,0 +1,331 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "atom.h"
+#include "binaryio.h"
+
+using namespace std;
+
+namespace PTools{
+
+
+static const char binaryMagic[8] = {'P','T','O','O','L','S','B','S'};
+static const uint32_t binaryVersion = 1;
+static const uint32_t binaryByteOrder = 0x01020304;
+static const uint32_t attractColumns = 1; ///< flag: the Attract columns are valid
+
+
+struct BinaryHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteorder;
+    uint32_t natoms;
+    uint32_t nstrings;
+    uint32_t stringbytes;
+    uint32_t flags;
+    uint32_t reserved[2];
+};
+
+
+/// offsets of the columns in a file
+struct BinaryLayout
+{
+    size_t x, y, z, charge;
+    size_t category, residid, atomid;
+    size_t atomtype, residtype, chain, extra;
+    size_t stringoffsets, strings, total;
+
+    BinaryLayout(const BinaryHeader& h)
+    {
+        size_t n = h.natoms;
+        size_t pos = sizeof(BinaryHeader);
+        x = pos; pos = align(pos + 8*n);
+        y = pos; pos = align(pos + 8*n);
+        z = pos; pos = align(pos + 8*n);
+        charge = pos; pos = align(pos + 8*n);
+        category = pos; pos = align(pos + 4*n);
+        residid = pos; pos = align(pos + 4*n);
+        atomid = pos; pos = align(pos + 4*n);
+        atomtype = pos; pos = align(pos + 4*n);
+        residtype = pos; pos = align(pos + 4*n);
+        chain = pos; pos = align(pos + 4*n);
+        extra = pos; pos = align(pos + 4*n);
+        stringoffsets = pos; pos = align(pos + 4*((size_t) h.nstrings + 1));
+        strings = pos; pos = align(pos + h.stringbytes);
+        total = pos;
+    }
+
+    static size_t align(size_t pos) {return (pos + 7) & ~(size_t) 7;};
+};
+
+
+
+/// interns the strings of a file
+class StringTable
+{
+public:
+    uint32_t index(const std::string& s)
+    {
+        std::map<std::string, uint32_t>::const_iterator it = m_index.find(s);
+        if (it != m_index.end()) return it->second;
+        uint32_t i = m_offsets.size();
+        m_index[s] = i;
+        m_offsets.push_back(m_chars.size());
+        m_chars.insert(m_chars.end(), s.begin(), s.end());
+        return i;
+    }
+
+    uint32_t size() const {return m_offsets.size();};
+    /// size() + 1 offsets, the last one is the number of characters
+    std::vector<uint32_t> offsets() const
+    {
+        std::vector<uint32_t> offsets(m_offsets);
+        offsets.push_back(m_chars.size());
+        return offsets;
+    }
+    const std::vector<char>& chars() const {return m_chars;};
+
+private:
+    std::map<std::string, uint32_t> m_index;
+    std::vector<uint32_t> m_offsets;
+    std::vector<char> m_chars;
+};
+
+
+/// writes a column followed by its padding
+template <class T>
+static void writeColumn(FILE* file, const std::vector<T>& column, size_t begin, size_t end)
+{
+    if (!column.empty()) fwrite(&column[0], sizeof(T), column.size(), file);
+    static const char zeros[8] = {0,0,0,0,0,0,0,0};
+    size_t written = begin + sizeof(T)*column.size();
+    fwrite(zeros, 1, end - written, file);
+}
+
+
+
+void WriteBinaryStructure(const Rigidbody& rigid, const std::string& filename)
+{
+    uint n = rigid.Size();
+    std::vector<double> x(n), y(n), z(n), charge(n);
+    std::vector<int32_t> category(n), residid(n);
+    std::vector<uint32_t> atomid(n), atomtype(n), residtype(n), chain(n), extra(n);
+    StringTable strings;
+    bool attract = true;
+
+    for (uint i=0; i<n; i++)
+    {
+        const Atomproperty& at = rigid.GetAtomProperty(i);
+        Coord3D co = rigid.GetCoords(i);
+        x[i] = co.x;
+        y[i] = co.y;
+        z[i] = co.z;
+        residid[i] = at.GetResidId();
+        atomid[i] = at.GetAtomId();
+        atomtype[i] = strings.index(at.GetType());
+        residtype[i] = strings.index(at.GetResidType());
+        chain[i] = strings.index(at.GetChainId());
+        extra[i] = strings.index(at.GetExtra());
+
+        //same reading as AttractRigidbody
+        uint cat = 0;
+        dbl ch = 0.0;
+        if (at.HasAttractFields())
+        {
+            category[i] = at.GetAtomCategory();
+            charge[i] = at.GetAttractCharge();
+        }
+        else if (std::istringstream(at.GetExtra()) >> cat >> ch)
+        {
+            category[i] = cat;
+            charge[i] = ch;
+        }
+        else attract = false;
+    }
+
+    BinaryHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, binaryMagic, sizeof(binaryMagic));
+    h.version = binaryVersion;
+    h.byteorder = binaryByteOrder;
+    h.natoms = n;
+    h.nstrings = strings.size();
+    h.stringbytes = strings.chars().size();
+    h.flags = attract ? attractColumns : 0;
+    BinaryLayout l(h);
+
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (!file) throw std::invalid_argument("##### WriteBinaryStructure:Could not open file \"" + filename + "\" #####");
+
+    fwrite(&h, sizeof(h), 1, file);
+    writeColumn(file, x, l.x, l.y);
+    writeColumn(file, y, l.y, l.z);
+    writeColumn(file, z, l.z, l.charge);
+    writeColumn(file, charge, l.charge, l.category);
+    writeColumn(file, category, l.category, l.residid);
+    writeColumn(file, residid, l.residid, l.atomid);
+    writeColumn(file, atomid, l.atomid, l.atomtype);
+    writeColumn(file, atomtype, l.atomtype, l.residtype);
+    writeColumn(file, residtype, l.residtype, l.chain);
+    writeColumn(file, chain, l.chain, l.extra);
+    writeColumn(file, extra, l.extra, l.stringoffsets);
+    writeColumn(file, strings.offsets(), l.stringoffsets, l.strings);
+    writeColumn(file, strings.chars(), l.strings, l.total);
+
+    bool failed = ferror(file);
+    if (fclose(file) != 0 || failed)
+        throw std::runtime_error("##### WriteBinaryStructure:Could not write file \"" + filename + "\" #####");
+}
+
+
+/// checks a mapped file and appends its atoms to protein
+static void readBinaryBuffer(const char* buffer, size_t size, const std::string& filename, Rigidbody& protein)
+{
+    BinaryHeader h;
+    if (size < sizeof(h)) throw std::invalid_argument("##### ReadBinaryStructure:truncated file \"" + filename + "\" #####");
+    memcpy(&h, buffer, sizeof(h));
+    if (memcmp(h.magic, binaryMagic, sizeof(binaryMagic)) != 0)
+        throw std::invalid_argument("##### ReadBinaryStructure:\"" + filename + "\" is not a binary structure file #####");
+    if (h.byteorder != binaryByteOrder)
+        throw std::invalid_argument("##### ReadBinaryStructure:\"" + filename + "\" was written with another byte order #####");
+    if (h.version != binaryVersion)
+        throw std::invalid_argument("##### ReadBinaryStructure:unsupported version of file \"" + filename + "\" #####");
+
+    BinaryLayout l(h);
+    if (size < l.total) throw std::invalid_argument("##### ReadBinaryStructure:truncated file \"" + filename + "\" #####");
+
+    //unique strings, decoded once
+    const uint32_t* offsets = (const uint32_t*) (buffer + l.stringoffsets);
+    const char* chars = buffer + l.strings;
+    std::vector<std::string> strings(h.nstrings);
+    for (uint32_t s=0; s<h.nstrings; s++)
+    {
+        if (offsets[s] > offsets[s+1] || offsets[s+1] > h.stringbytes)
+            throw std::invalid_argument("##### ReadBinaryStructure:corrupted string table in \"" + filename + "\" #####");
+        strings[s].assign(chars + offsets[s], chars + offsets[s+1]);
+    }
+
+    const double* x = (const double*) (buffer + l.x);
+    const double* y = (const double*) (buffer + l.y);
+    const double* z = (const double*) (buffer + l.z);
+    const double* charge = (const double*) (buffer + l.charge);
+    const int32_t* category = (const int32_t*) (buffer + l.category);
+    const int32_t* residid = (const int32_t*) (buffer + l.residid);
+    const uint32_t* atomid = (const uint32_t*) (buffer + l.atomid);
+    const uint32_t* columns[4] = {(const uint32_t*) (buffer + l.atomtype), (const uint32_t*) (buffer + l.residtype),
+                                  (const uint32_t*) (buffer + l.chain), (const uint32_t*) (buffer + l.extra)};
+    for (uint c=0; c<4; c++)
+        for (uint32_t i=0; i<h.natoms; i++)
+            if (columns[c][i] >= h.nstrings)
+                throw std::invalid_argument("##### ReadBinaryStructure:corrupted string index in \"" + filename + "\" #####");
+
+    protein.Reserve(protein.Size() + h.natoms);
+    Atomproperty a;
+    for (uint32_t i=0; i<h.natoms; i++)
+    {
+        a.SetType(strings[columns[0][i]]);
+        a.SetResidType(strings[columns[1][i]]);
+        a.SetChainId(strings[columns[2][i]]);
+        a.SetExtra(strings[columns[3][i]]);
+        a.SetResidId(residid[i]);
+        a.SetAtomId(atomid[i]);
+        if (h.flags & attractColumns) a.SetAttractFields(category[i], charge[i]);
+        protein.AddAtom(a, Coord3D(x[i], y[i], z[i]));
+    }
+}
+
+
+void ReadBinaryStructure(const std::string& filename, Rigidbody& protein)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) throw std::invalid_argument("##### ReadBinaryStructure:Could not open file \"" + filename + "\" #####");
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(BinaryHeader))
+    {
+        close(fd);
+        throw std::invalid_argument("##### ReadBinaryStructure:truncated file \"" + filename + "\" #####");
+    }
+
+    void* map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) throw std::invalid_argument("##### ReadBinaryStructure:Could not map file \"" + filename + "\" #####");
+
+    try
+    {
+        readBinaryBuffer((const char*) map, st.st_size, filename, protein);
+    }
+    catch (...)
+    {
+        munmap(map, st.st_size);
+        throw;
+    }
+    munmap(map, st.st_size);
+}
+
+
+bool IsBinaryStructure(const std::string& filename)
+{
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (!file) return false;
+    char magic[sizeof(binaryMagic)];
+    bool binary = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, binaryMagic, sizeof(magic)) == 0;
+    fclose(file);
+    return binary;
+}
+
+
+static bool endsWith(const std::string& s, const std::string& suffix)
+{
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+
+uint ConvertStructures(const std::string& indir, const std::string& outdir)
+{
+    DIR* dir = opendir(indir.c_str());
+    if (!dir) throw std::invalid_argument("##### ConvertStructures:Could not open directory \"" + indir + "\" #####");
+    std::vector<std::string> names;
+    for (struct dirent* entry = readdir(dir); entry != 0; entry = readdir(dir))
+    {
+        std::string name = entry->d_name;
+        if (endsWith(name, ".pdb") || endsWith(name, ".red")) names.push_back(name);
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+
+    uint converted = 0;
+    int n = names.size();
+    #pragma omp parallel for schedule(dynamic) reduction(+:converted)
+    for (int i=0; i<n; i++)
+    {
+        try
+        {
+            Rigidbody rigid(indir + "/" + names[i]);
+            WriteBinaryStructure(rigid, outdir + "/" + names[i] + ".bin");
+            converted++;
+        }
+        catch (std::exception& e)
+        {
+            #pragma omp critical
+            std::cerr << "ConvertStructures: " << names[i] << ": " << e.what() << std::endl;
+        }
+    }
+    return converted;
+}
+
+
+} //namespace PTools
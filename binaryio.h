@@ -0,0 +1,43 @@
+#ifndef BINARYIO_H
+#define BINARYIO_H
+
+#include <string>
+#include <vector>
+
+#include "rigidbody.h"
+
+namespace PTools
+{
+
+
+/*! \brief compact binary structure files
+*
+*   a versioned file made of a header followed by columns (8 bytes aligned):
+*   - x, y, z coordinates and the Attract charges (double),
+*   - Attract atom categories, residue and atom numbers (32 bits integers),
+*   - atom names, residue names, chain ids and extra fields as indices in a
+*     table of unique strings, which follows the columns.
+*
+*   Files are read through a memory mapping: columns are copied in bulk and each
+*   unique name is decoded once. The Attract columns hold the category and
+*   charge of the extra fields when all the atoms have them (flag in the header),
+*   they are then given to the atoms (see Atomproperty::SetAttractFields()).
+*   Files are written with the byte order of the machine, other byte orders are
+*   rejected.
+*/
+
+void WriteBinaryStructure(const Rigidbody& rigid, const std::string& filename); ///< write a Rigidbody in the binary format
+void ReadBinaryStructure(const std::string& filename, Rigidbody& protein); ///< append the atoms of a binary file to a Rigidbody
+bool IsBinaryStructure(const std::string& filename); ///< true if the file starts like a binary structure file
+
+/*! \brief converts the PDB/.red files of a directory to binary files
+*
+*   outdir/name.bin is written for each file 'name' of indir ending with .pdb or
+*   .red. Files are converted in parallel (OpenMP), files that cannot be read
+*   are reported on stderr and skipped. Returns the number of converted files.
+*/
+uint ConvertStructures(const std::string& indir, const std::string& outdir);
+
+}
+
+#endif //#ifndef BINARYIO_H
@@ -0,0 +1,174 @@
+
+#include "clustering.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+
+namespace PTools
+{
+
+
+/// sorts pose indices by energy
+struct EnergyOrder
+{
+    EnergyOrder(const std::vector<dbl>& energies): _energies(energies) {};
+    bool operator()(uint a, uint b) const {return _energies[a] < _energies[b];};
+    const std::vector<dbl>& _energies;
+};
+
+
+
+PoseClustering::PoseClustering(const Rigidbody& lig, dbl rmsdcutoff, dbl energycutoff)
+        :m_rmsd(lig), m_rmsdcutoff(rmsdcutoff), m_energycutoff(energycutoff), m_rmsdcomputed(0)
+{
+    if (rmsdcutoff <= 0.0) throw std::invalid_argument("PoseClustering: the rmsd cutoff must be positive");
+}
+
+
+uint PoseClustering::AddPose(dbl energy, const dbl* mat)
+{
+    m_energies.push_back(energy);
+    m_points.resize(m_points.size() + MatrixRmsd::EmbeddingSize);
+    m_rmsd.embed(mat, &m_points[m_points.size() - MatrixRmsd::EmbeddingSize]);
+    return m_energies.size()-1;
+}
+
+
+uint PoseClustering::AddPose(dbl energy, const Matrix& mat)
+{
+    dbl m[16];
+    for (uint i=0; i<4; i++)
+        for (uint j=0; j<4; j++)
+            m[4*i+j] = mat(i,j);
+    return AddPose(energy, m);
+}
+
+
+uint PoseClustering::AddPose(dbl energy, const std::vector<dbl>& mat)
+{
+    if (mat.size() != 16) throw std::invalid_argument("PoseClustering::AddPose: a 4x4 matrix needs 16 values");
+    return AddPose(energy, &mat[0]);
+}
+
+
+PoseClustering::CellKey PoseClustering::cellKey(int i, int j, int k) const
+{
+    //21 bits per dimension
+    const CellKey mask = (1ULL << 21) - 1;
+    return (((CellKey) (i + (1<<20)) & mask) << 42) | (((CellKey) (j + (1<<20)) & mask) << 21) | ((CellKey) (k + (1<<20)) & mask);
+}
+
+
+void PoseClustering::cellOf(const dbl* point, int cell[3]) const
+{
+    //the last 3 values of an embedding are the center of the moved ligand
+    for (uint d=0; d<3; d++)
+        cell[d] = (int) floor(point[9+d] / m_rmsdcutoff);
+}
+
+
+/// most recent cluster (index >= firstcluster) that accepts the pose, -1 if none
+int PoseClustering::findCluster(uint pose, uint firstcluster, unsigned long long& computed) const
+{
+    const dbl* p = &m_points[MatrixRmsd::EmbeddingSize*(size_t) pose];
+    const dbl cutoff2 = m_rmsdcutoff*m_rmsdcutoff;
+    int cell[3];
+    cellOf(p, cell);
+
+    int best = -1;
+    for (int i=cell[0]-1; i<=cell[0]+1; i++)
+        for (int j=cell[1]-1; j<=cell[1]+1; j++)
+            for (int k=cell[2]-1; k<=cell[2]+1; k++)
+            {
+                std::map<CellKey, std::vector<uint> >::const_iterator it = m_grid.find(cellKey(i,j,k));
+                if (it == m_grid.end()) continue;
+                const std::vector<uint>& clusters = it->second;
+                for (uint c=0; c<clusters.size(); c++)
+                {
+                    int cluster = clusters[c];
+                    if (cluster <= best || (uint) cluster < firstcluster) continue;
+                    uint rep = m_representatives[cluster];
+                    if (m_energies[rep] - m_energies[pose] >= m_energycutoff) continue;
+
+                    const dbl* q = &m_points[MatrixRmsd::EmbeddingSize*(size_t) rep];
+                    //centers first: lower bound of the rmsd
+                    dbl d2 = 0.0;
+                    for (uint l=9; l<12; l++) d2 += (p[l]-q[l])*(p[l]-q[l]);
+                    if (d2 >= cutoff2) continue;
+                    for (uint l=0; l<9; l++) d2 += (p[l]-q[l])*(p[l]-q[l]);
+                    computed++;
+                    if (d2 < cutoff2) best = cluster;
+                }
+            }
+
+    return best;
+}
+
+
+void PoseClustering::Run(uint nstruct)
+{
+    std::vector<uint> order(NbPoses());
+    for (uint i=0; i<order.size(); i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), EnergyOrder(m_energies));
+    if (nstruct > 0 && nstruct < order.size()) order.resize(nstruct);
+
+    m_representatives.clear();
+    m_sizes.clear();
+    m_grid.clear();
+    m_assignments.assign(NbPoses(), -1);
+    m_rmsdcomputed = 0;
+
+    //poses of a block are compared in parallel to the clusters created before the
+    //block, then sequentially to the clusters created within the block
+    const uint blocksize = 256;
+    std::vector<int> found(blocksize);
+    for (uint start=0; start<order.size(); start+=blocksize)
+    {
+        int n = std::min(blocksize, (uint) order.size() - start);
+        uint nclusters = NbClusters();
+        unsigned long long computed = 0;
+
+        #pragma omp parallel for schedule(dynamic,8) reduction(+:computed)
+        for (int i=0; i<n; i++)
+            found[i] = findCluster(order[start+i], 0, computed);
+
+        for (int i=0; i<n; i++)
+        {
+            uint pose = order[start+i];
+            int cluster = findCluster(pose, nclusters, computed);
+            if (cluster < 0) cluster = found[i];
+
+            if (cluster < 0)
+            {
+                cluster = m_representatives.size();
+                m_representatives.push_back(pose);
+                m_sizes.push_back(0);
+                int cell[3];
+                cellOf(&m_points[MatrixRmsd::EmbeddingSize*(size_t) pose], cell);
+                m_grid[cellKey(cell[0], cell[1], cell[2])].push_back(cluster);
+            }
+            m_sizes[cluster]++;
+            m_assignments[pose] = cluster;
+        }
+        m_rmsdcomputed += computed;
+    }
+}
+
+
+uint PoseClustering::GetRepresentative(uint i) const
+{
+    if (i >= NbClusters()) throw std::out_of_range("PoseClustering::GetRepresentative: cluster index out of range");
+    return m_representatives[i];
+}
+
+
+uint PoseClustering::GetClusterSize(uint i) const
+{
+    if (i >= NbClusters()) throw std::out_of_range("PoseClustering::GetClusterSize: cluster index out of range");
+    return m_sizes[i];
+}
+
+
+} // namespace PTools
@@ -0,0 +1,90 @@
+//  clustering of docking poses
+//
+//
+
+
+
+#ifndef _CLUSTERING_H_
+#define _CLUSTERING_H_
+
+#include "rigidbody.h"
+#include "rmsd.h"
+
+#include <map>
+
+
+namespace PTools{
+
+
+/*! \brief greedy clustering of the poses of a rigid ligand
+*
+*   poses (energy, 4x4 matrix) are sorted by energy. Each pose joins the most
+*   recently created cluster whose representative (lowest energy pose) is within
+*   the rmsd and energy cutoffs, otherwise it creates a new cluster. All the
+*   clusters are considered.
+*
+*   RMSDs are computed from the matrices (see MatrixRmsd). The distance between
+*   ligand centers is a lower bound of the RMSD: representatives are stored in a
+*   grid of their centers with a cell size equal to the rmsd cutoff, so that only
+*   the 27 cells around a pose are searched. Poses are compared in parallel
+*   (OpenMP) by blocks, the result does not depend on the number of threads.
+*/
+class PoseClustering
+{
+
+public:
+
+    PoseClustering(const Rigidbody& lig, dbl rmsdcutoff=1.0, dbl energycutoff=1e30);
+
+    ///adds a pose, returns its index
+    uint AddPose(dbl energy, const Matrix& mat);
+    ///same with a matrix of 16 values (row major)
+    uint AddPose(dbl energy, const dbl* mat);
+    ///same with a vector of 16 values (row major), for python
+    uint AddPose(dbl energy, const std::vector<dbl>& mat);
+
+    ///clusters the nstruct lowest energy poses (0: all the poses)
+    void Run(uint nstruct=0);
+
+    uint NbPoses() const {return m_energies.size();};
+    uint NbClusters() const {return m_representatives.size();};
+
+    ///index of the lowest energy pose of cluster i (clusters are sorted by energy)
+    uint GetRepresentative(uint i) const;
+    ///number of poses in cluster i
+    uint GetClusterSize(uint i) const;
+    ///cluster of each pose, -1 for the poses that were not clustered
+    std::vector<int> GetAssignments() const {return m_assignments;};
+
+    ///number of RMSD evaluations of the last Run()
+    unsigned long long NbRmsdComputed() const {return m_rmsdcomputed;};
+
+
+private:
+
+    typedef unsigned long long CellKey;
+
+    CellKey cellKey(int i, int j, int k) const;
+    void cellOf(const dbl* point, int cell[3]) const;
+    int findCluster(uint pose, uint firstcluster, unsigned long long& computed) const;
+
+    MatrixRmsd m_rmsd;
+    dbl m_rmsdcutoff;
+    dbl m_energycutoff;
+
+    std::vector<dbl> m_energies;
+    std::vector<dbl> m_points; ///< embedding of each pose (MatrixRmsd::EmbeddingSize values)
+
+    std::vector<uint> m_representatives;
+    std::vector<uint> m_sizes;
+    std::vector<int> m_assignments;
+    std::map<CellKey, std::vector<uint> > m_grid; ///< clusters by cell of their representative center
+
+    unsigned long long m_rmsdcomputed;
+
+};
+
+
+}//namespace PTools
+
+#endif // _CLUSTERING_H_
@@ -96,10 +96,23 @@ public:
 
     void AddCoord(const Coord3D& co) {_refcoords.push_back(co); _movedcoords.push_back(co);  _modified();  };
     uint Size() const {return _refcoords.size();};
+    void Reserve(uint n) {_refcoords.reserve(n); _movedcoords.reserve(n);};
 
 
     void GetCoords(const uint i, Coord3D& co)  const throw(std::out_of_range) ;
 
+    /// coordinates of all the atoms after rotation/translation (updated if needed, no copy). Valid until the next move
+    const Coord3D* movedCoords() const
+    {
+        if (Size() == 0) return 0;
+        if (!_uptodate)
+        {
+            Coord3D co;
+            (*this.* _getcoords)(0, co);
+        }
+        return &_movedcoords[0];
+    }
+
     void SetCoords(const uint k, const Coord3D& co);
 
     /// Translate the whole object
@@ -114,6 +127,14 @@ public:
     ///return the rotation/translation matrix
     Matrix GetMatrix() const;
 
+    /// copy the rotation/translation matrix into 'mat' (no allocation)
+    void CopyMatrix(dbl mat[4][4]) const
+    {
+        for (uint i=0; i<4; i++)
+            for (uint j=0; j<4; j++)
+                mat[i][j] = mat44[i][j];
+    }
+
 
 
 protected:
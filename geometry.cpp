@@ -325,7 +325,7 @@ dbl Angle(const Coord3D& vector1, const Coord3D& vector2)
     return acos(costheta);
 }
 
-dbl MakeTranslationMat44(Coord3D t, dbl out[4][4] )
+void MakeTranslationMat44(Coord3D t, dbl out[4][4] )
 {
     for (int i=0; i<4; i++)
       for(int j=0; j<4; j++)
@@ -1,5 +1,6 @@
 import os
 from pyplusplus import module_builder
+from pygccxml import declarations
 
 import fnmatch
 
@@ -36,6 +37,9 @@ rigidbody = mb.class_("Rigidbody")
 #getatom = rigidbody.member_function("GetAtomReference")
 #getatom.call_policies = module_builder.call_policies.return_internal_reference()
 rigidbody.include()
+rigidbody.member_function("GetMovedCoords").exclude()
+rigidbody.member_function("CopyMatrix").exclude()
+coordsarray.member_function("CopyMatrix").exclude()
 
 attractrigidbody=mb.class_("AttractRigidbody")
 attractrigidbody.include()
@@ -72,6 +76,25 @@ attractForceField2.include()
 McopForceField = mb.class_("McopForceField")
 McopForceField.include()
 
+MonteCarlo = mb.class_("MonteCarlo")
+MonteCarlo.include()
+
+#overloads taking raw arrays of doubles are for C++ callers only:
+def has_pointer_arg(f):
+    return len([a for a in f.arguments if declarations.is_pointer(a.type)]) > 0
+
+MatrixRmsd = mb.class_("MatrixRmsd")
+MatrixRmsd.include()
+MatrixRmsd.member_functions(function=has_pointer_arg).exclude()
+
+PoseClustering = mb.class_("PoseClustering")
+PoseClustering.include()
+PoseClustering.member_functions(function=has_pointer_arg).exclude()
+
+InterfaceEvaluator = mb.class_("InterfaceEvaluator")
+InterfaceEvaluator.include()
+InterfaceEvaluator.member_functions(function=has_pointer_arg).exclude()
+
 
 AtomPair = mb.class_("AtomPair")
 AtomPair.include()
@@ -110,10 +133,16 @@ PrintCoord=mb.free_function("PrintCoord")
 PrintCoord.include()
 WritePDB=mb.free_function("WritePDB")
 WritePDB.include()
+mb.free_function("WriteBinaryStructure").include()
+mb.free_function("ReadBinaryStructure").include()
+mb.free_function("IsBinaryStructure").include()
+mb.free_function("ConvertStructures").include()
+mb.class_("PDBWriter").include()
 
 
 atomselection = mb.class_("AtomSelection")
 atomselection.include()
+atomselection.member_function("GetCoordsView").exclude()
 
 screw =mb.class_("Screw")
 printscrew = screw.member_function("print")
@@ -0,0 +1,241 @@
+
+#include "interfaceevaluator.h"
+#include "atomselection.h"
+
+#include <cmath>
+#include <map>
+#include <set>
+#include <stdexcept>
+
+
+namespace PTools
+{
+
+
+/// groups the atoms by residue id: atoms of residue r are atoms[begin[r] .. begin[r+1]-1]
+static void groupResidues(const Rigidbody& rig, std::vector<uint>& residue, std::vector<uint>& begin, std::vector<uint>& atoms)
+{
+    std::map<uint, uint> index; //residue id -> residue
+    residue.resize(rig.Size());
+    for (uint i=0; i<rig.Size(); i++)
+    {
+        uint resid = rig.GetAtomProperty(i).GetResidId();
+        std::map<uint, uint>::const_iterator it = index.find(resid);
+        if (it == index.end()) it = index.insert(std::make_pair(resid, (uint) index.size())).first;
+        residue[i] = it->second;
+    }
+
+    begin.assign(index.size()+1, 0);
+    for (uint i=0; i<residue.size(); i++) begin[residue[i]+1]++;
+    for (uint r=0; r<index.size(); r++) begin[r+1] += begin[r];
+
+    atoms.resize(residue.size());
+    std::vector<uint> next(begin.begin(), begin.end()-1);
+    for (uint i=0; i<residue.size(); i++) atoms[next[residue[i]]++] = i;
+}
+
+
+/// backbone atoms of rig belonging to the selected residues
+static std::vector<uint> interfaceBackbone(Rigidbody& rig, const std::vector<uint>& residue, const std::vector<bool>& selected)
+{
+    AtomSelection backbone = rig.Backbone();
+    SelectionCoords view = backbone.GetCoordsView();
+    std::vector<uint> atoms;
+    for (uint k=0; k<view.size; k++)
+        if (selected[residue[view.indices[k]]]) atoms.push_back(view.indices[k]);
+    return atoms;
+}
+
+
+static std::vector<Coord3D> coordsOf(const Rigidbody& rig)
+{
+    std::vector<Coord3D> coords(rig.Size());
+    for (uint i=0; i<rig.Size(); i++) coords[i] = rig.GetCoords(i);
+    return coords;
+}
+
+
+/// applies a matrix of 16 values (row major) to 'size' coordinates
+static void applyMatrix(const dbl* m, const Coord3D* in, uint size, Coord3D* out)
+{
+    for (uint i=0; i<size; i++)
+    {
+        const Coord3D& c = in[i];
+        out[i].x = m[0]*c.x + m[1]*c.y + m[2]*c.z + m[3];
+        out[i].y = m[4]*c.x + m[5]*c.y + m[6]*c.z + m[7];
+        out[i].z = m[8]*c.x + m[9]*c.y + m[10]*c.z + m[11];
+    }
+}
+
+
+
+InterfaceEvaluator::InterfaceEvaluator(const Rigidbody& receptor, const Rigidbody& ligref, dbl contactcutoff, dbl interfacecutoff)
+        :m_receptor(coordsOf(receptor)), m_ligref(coordsOf(ligref)), m_ligand(m_ligref),
+        m_contactcutoff2(contactcutoff*contactcutoff), m_superpose(false)
+{
+    std::vector<uint> recresidue, ligresidue;
+    groupResidues(receptor, recresidue, m_recresbegin, m_recresatoms);
+    groupResidues(ligref, ligresidue, m_ligresbegin, m_ligresatoms);
+
+    //native contacts and interface residues
+    const dbl interfacecutoff2 = interfacecutoff*interfacecutoff;
+    std::set<std::pair<uint, uint> > contacts;
+    std::vector<bool> recinterface(m_recresbegin.size()-1, false);
+    std::vector<bool> liginterface(m_ligresbegin.size()-1, false);
+    for (uint i=0; i<m_receptor.size(); i++)
+        for (uint j=0; j<m_ligref.size(); j++)
+        {
+            dbl d2 = Norm2(m_receptor[i] - m_ligref[j]);
+            if (d2 <= m_contactcutoff2) contacts.insert(std::make_pair(recresidue[i], ligresidue[j]));
+            if (d2 <= interfacecutoff2)
+            {
+                recinterface[recresidue[i]] = true;
+                liginterface[ligresidue[j]] = true;
+            }
+        }
+
+    for (std::set<std::pair<uint, uint> >::const_iterator it = contacts.begin(); it != contacts.end(); ++it)
+    {
+        m_contactrec.push_back(it->first);
+        m_contactlig.push_back(it->second);
+    }
+
+    //interface backbone, and reference for the superposition
+    Rigidbody rec(receptor), lig(ligref);
+    m_iflig = interfaceBackbone(lig, ligresidue, liginterface);
+    m_ifrec = interfaceBackbone(rec, recresidue, recinterface);
+    if (m_iflig.empty()) throw std::invalid_argument("InterfaceEvaluator: no backbone atom in the ligand interface");
+
+    std::vector<Coord3D> reference;
+    for (uint k=0; k<m_iflig.size(); k++) reference.push_back(m_ligref[m_iflig[k]]);
+    for (uint k=0; k<m_ifrec.size(); k++) reference.push_back(m_receptor[m_ifrec[k]]);
+    m_interface = Superposer(reference);
+
+    //L-RMSD atoms
+    std::vector<bool> all(m_ligresbegin.size()-1, true);
+    m_lrmsdatoms = interfaceBackbone(lig, ligresidue, all);
+}
+
+
+void InterfaceEvaluator::checkLigand(const Rigidbody& lig) const
+{
+    if (lig.Size() != m_ligref.size())
+        throw std::invalid_argument("InterfaceEvaluator: the ligand and the reference ligand sizes differ");
+}
+
+
+void InterfaceEvaluator::SetLigand(const Rigidbody& lig)
+{
+    checkLigand(lig);
+    m_ligand = coordsOf(lig);
+}
+
+
+dbl InterfaceEvaluator::fnat(const Coord3D* lig) const
+{
+    if (m_contactrec.empty()) return 0.0;
+    uint found = 0;
+    for (uint c=0; c<m_contactrec.size(); c++)
+    {
+        uint recres = m_contactrec[c];
+        uint ligres = m_contactlig[c];
+        bool contact = false;
+        for (uint i=m_recresbegin[recres]; i<m_recresbegin[recres+1] && !contact; i++)
+        {
+            const Coord3D& a = m_receptor[m_recresatoms[i]];
+            for (uint j=m_ligresbegin[ligres]; j<m_ligresbegin[ligres+1]; j++)
+                if (Norm2(a - lig[m_ligresatoms[j]]) <= m_contactcutoff2)
+                {
+                    contact = true;
+                    break;
+                }
+        }
+        if (contact) found++;
+    }
+    return (dbl) found / (dbl) m_contactrec.size();
+}
+
+
+dbl InterfaceEvaluator::irmsd(const Coord3D* lig, std::vector<Coord3D>& buffer) const
+{
+    if (!m_superpose)
+    {
+        dbl sum = 0.0;
+        for (uint k=0; k<m_iflig.size(); k++)
+            sum += Norm2(lig[m_iflig[k]] - m_ligref[m_iflig[k]]);
+        return sqrt(sum / m_iflig.size());
+    }
+
+    buffer.resize(m_iflig.size() + m_ifrec.size());
+    for (uint k=0; k<m_iflig.size(); k++) buffer[k] = lig[m_iflig[k]];
+    for (uint k=0; k<m_ifrec.size(); k++) buffer[m_iflig.size()+k] = m_receptor[m_ifrec[k]];
+    return m_interface.fit(&buffer[0]).rmsd;
+}
+
+
+dbl InterfaceEvaluator::lrmsd(const Coord3D* lig) const
+{
+    if (m_lrmsdatoms.empty()) return 0.0;
+    dbl sum = 0.0;
+    for (uint k=0; k<m_lrmsdatoms.size(); k++)
+        sum += Norm2(lig[m_lrmsdatoms[k]] - m_ligref[m_lrmsdatoms[k]]);
+    return sqrt(sum / m_lrmsdatoms.size());
+}
+
+
+dbl InterfaceEvaluator::Fnat(const Rigidbody& lig) const
+{
+    checkLigand(lig);
+    return fnat(lig.GetMovedCoords());
+}
+
+
+dbl InterfaceEvaluator::Irmsd(const Rigidbody& lig) const
+{
+    checkLigand(lig);
+    std::vector<Coord3D> buffer;
+    return irmsd(lig.GetMovedCoords(), buffer);
+}
+
+
+dbl InterfaceEvaluator::Lrmsd(const Rigidbody& lig) const
+{
+    checkLigand(lig);
+    return lrmsd(lig.GetMovedCoords());
+}
+
+
+void InterfaceEvaluator::Evaluate(const dbl* matrices, uint nposes, dbl* fnats, dbl* irmsds, dbl* lrmsds) const
+{
+    int n = nposes;
+    #pragma omp parallel
+    {
+        //per-thread buffers
+        std::vector<Coord3D> moved(m_ligand.size());
+        std::vector<Coord3D> buffer;
+
+        #pragma omp for schedule(static)
+        for (int i=0; i<n; i++)
+        {
+            applyMatrix(matrices + 16*(size_t) i, &m_ligand[0], m_ligand.size(), &moved[0]);
+            fnats[i] = fnat(&moved[0]);
+            irmsds[i] = irmsd(&moved[0], buffer);
+            lrmsds[i] = lrmsd(&moved[0]);
+        }
+    }
+}
+
+
+void InterfaceEvaluator::Evaluate(const std::vector<dbl>& matrices, std::vector<dbl>& fnats, std::vector<dbl>& irmsds, std::vector<dbl>& lrmsds) const
+{
+    if (matrices.size() % 16 != 0) throw std::invalid_argument("InterfaceEvaluator::Evaluate: a 4x4 matrix needs 16 values");
+    uint nposes = matrices.size() / 16;
+    fnats.resize(nposes);
+    irmsds.resize(nposes);
+    lrmsds.resize(nposes);
+    if (nposes == 0) return;
+    Evaluate(&matrices[0], nposes, &fnats[0], &irmsds[0], &lrmsds[0]);
+}
+
+
+} // namespace PTools
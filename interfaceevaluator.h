@@ -0,0 +1,94 @@
+//  evaluation of docking poses against a reference complex
+//
+//
+
+
+
+#ifndef _INTERFACEEVALUATOR_H_
+#define _INTERFACEEVALUATOR_H_
+
+#include "rigidbody.h"
+#include "superpose.h"
+
+
+namespace PTools{
+
+
+/*! \brief fnat, I-RMSD and L-RMSD of many ligand poses
+*
+*   the receptor is fixed and the reference ligand gives the native complex.
+*   Residues (identified by their residue id, as in fnat.py and irmsd.py) are in
+*   contact when two of their atoms are closer than the contact cutoff (7A), and
+*   belong to the interface when two of their atoms are closer than the interface
+*   cutoff (10A, 14A is used for reduced models).
+*
+*   The native contacts and the interface backbone atoms are collected once by
+*   the constructor, then each pose costs:
+*   - fnat: fraction of the native contacts present in the pose, only the atoms
+*     of natively contacting residues are compared (0 without native contact),
+*   - I-RMSD: backbone of the ligand interface residues, either without
+*     superposition (default, as irmsd.py) or after the superposition of the
+*     interface backbone of the receptor and of the ligand (irmsd.py -s),
+*   - L-RMSD: backbone of the ligand, without superposition.
+*
+*   Poses are 4x4 matrices applied to the ligand given to SetLigand() (by default
+*   the reference ligand itself), they are evaluated in parallel (OpenMP).
+*/
+class InterfaceEvaluator
+{
+
+public:
+
+    InterfaceEvaluator(const Rigidbody& receptor, const Rigidbody& ligref, dbl contactcutoff=7.0, dbl interfacecutoff=10.0);
+
+    ///ligand moved by the matrices given to Evaluate() (same atoms as the reference ligand)
+    void SetLigand(const Rigidbody& lig);
+    ///superposes the interface backbone before the I-RMSD (default: false)
+    void SetInterfaceSuperposition(bool superpose) {m_superpose = superpose;};
+
+    ///scores of a ligand at its current position
+    dbl Fnat(const Rigidbody& lig) const;
+    dbl Irmsd(const Rigidbody& lig) const;
+    dbl Lrmsd(const Rigidbody& lig) const;
+
+    /*! \brief scores of nposes matrices of 16 values (row major) stored one after the other
+    *
+    *   fnat, irmsd and lrmsd receive one value per pose.
+    */
+    void Evaluate(const dbl* matrices, uint nposes, dbl* fnat, dbl* irmsd, dbl* lrmsd) const;
+    ///same with a vector of 16*nposes values, for python
+    void Evaluate(const std::vector<dbl>& matrices, std::vector<dbl>& fnat, std::vector<dbl>& irmsd, std::vector<dbl>& lrmsd) const;
+
+    uint NbNativeContacts() const {return m_contactrec.size();};
+    uint NbInterfaceAtoms() const {return m_iflig.size() + m_ifrec.size();}; ///< interface backbone atoms (receptor and ligand)
+
+private:
+
+    dbl fnat(const Coord3D* lig) const;
+    dbl irmsd(const Coord3D* lig, std::vector<Coord3D>& buffer) const;
+    dbl lrmsd(const Coord3D* lig) const;
+    void checkLigand(const Rigidbody& lig) const;
+
+    std::vector<Coord3D> m_receptor;
+    std::vector<Coord3D> m_ligref;
+    std::vector<Coord3D> m_ligand; ///< ligand moved by the matrices
+
+    dbl m_contactcutoff2;
+    bool m_superpose;
+
+    //atoms of each residue: m_resatoms[m_resbegin[r] .. m_resbegin[r+1]-1]
+    std::vector<uint> m_recresbegin, m_recresatoms;
+    std::vector<uint> m_ligresbegin, m_ligresatoms;
+    std::vector<uint> m_contactrec, m_contactlig; ///< residues of the native contacts
+
+    std::vector<uint> m_iflig, m_ifrec; ///< interface backbone atoms
+    std::vector<uint> m_lrmsdatoms; ///< backbone of the ligand
+
+    Superposer m_interface; ///< reference interface backbone, ligand then receptor
+
+};
+
+
+}//namespace PTools
+
+#endif // _INTERFACEEVALUATOR_H_
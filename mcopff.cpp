@@ -1,5 +1,12 @@
 #include "mcopff.h"
 #include <cassert>
+#include <cfloat> //DBL_MAX
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
 namespace PTools
@@ -9,6 +16,9 @@ namespace PTools
 Mcoprigid::Mcoprigid()
 {
     _complete = false;
+    _posestamp = 0;
+    _posematrixstamp = 0;
+    _posematrix = _pose.GetMatrix();
 
 };
 
@@ -18,38 +28,87 @@ Mcoprigid::Mcoprigid()
 void Mcoprigid::setMain(AttractRigidbody& main) {
     _main=main;
     _center = _main.FindCenter();
+    _mainpose = newPose(_main);
 
 };
 
 
-void Mcoprigid::AttractEulerRotate(const dbl& phi, const dbl& ssi, const dbl& rot)
+void Mcoprigid::addEnsemble(const Region& reg)
 {
-//Warning: makes euler rotation without centering
-//the Mcoprigid object must be centered
+    _vregion.push_back(reg);
+    std::vector<dbl> v;
+    _weights.push_back(v);
+
+    std::vector<BodyPose> poses;
+    for (uint i=0; i<_vregion.back().size(); i++)
+        poses.push_back(newPose(_vregion.back()[i]));
+    _copypose.push_back(poses);
+}
 
 
-//rotates the main body:
-    _main.AttractEulerRotate(phi, ssi, rot);
+Mcoprigid::BodyPose Mcoprigid::newPose(AttractRigidbody& body)
+{
+    BodyPose pose;
+    pose.initial = body.GetMatrix();
+    pose.stamp = _posestamp - 1; //the shared transformation must be applied at the first access
+    return pose;
+}
+
 
+/// applies the shared transformation to a body that was not accessed since the last move
+void Mcoprigid::sync(AttractRigidbody& body, BodyPose& pose)
+{
+    if (pose.stamp == _posestamp) return;
 
-//for each multicopy region, rotates the copy:
-    for (uint i=0; i < _vregion.size(); i++)
-        for (uint j=0; j<_vregion[i].size(); j++)
-            _vregion[i][j].AttractEulerRotate(phi, ssi, rot);
+    if (_posematrixstamp != _posestamp)
+    {
+        _posematrix = _pose.GetMatrix();
+        _posematrixstamp = _posestamp;
+    }
 
+    body.ResetMatrix();
+    body.ApplyMatrix(pose.initial);
+    body.ApplyMatrix(_posematrix);
+    pose.stamp = _posestamp;
+}
+
+
+Region& Mcoprigid::getRegion(uint region)
+{
+    for (uint j=0; j<_vregion[region].size(); j++)
+        sync(_vregion[region][j], _copypose[region][j]);
+    return _vregion[region];
+}
+
+
+void Mcoprigid::AttractEulerRotate(const dbl& phi, const dbl& ssi, const dbl& rot)
+{
+//Warning: makes euler rotation without centering
+//the Mcoprigid object must be centered
+
+    _pose.AttractEulerRotate(phi, ssi, rot);
+    _posestamp++;
 }
 
 
 void Mcoprigid::Translate(const Coord3D& c)
 {
-//translates the main body:
-    _main.Translate(c);
+    _pose.Translate(c);
+    _posestamp++;
+}
+
+
+void Mcoprigid::ApplyMatrix(const Matrix& mat)
+{
+    _pose.ApplyMatrix(mat);
+    _posestamp++;
+}
 
-//for each multicopy region, translates the copy:
-    for (uint i=0; i < _vregion.size(); i++)
-        for (uint j=0; j<_vregion[i].size(); j++)
-            _vregion[i][j].Translate(c);
 
+void Mcoprigid::ResetMatrix()
+{
+    _pose.ResetMatrix();
+    _posestamp++;
 }
 
 
@@ -72,201 +131,568 @@ void Mcoprigid::PrintWeights()
 
 
 ///////////////////////////////////////////////////
-//     Forcefield implementation
+//     Region pairlist
 ///////////////////////////////////////////////////
 
 
-
-void McopForceField::calculate_weights(Mcoprigid& lig, bool print)
+RegionPairList::RegionPairList(const AttractRigidbody& body, const Region& region, dbl cutoff, dbl skin)
 {
+    m_squarecutoff = cutoff*cutoff;
+    m_skin = skin;
+    update(body, region);
+}
 
 
-//loop over copies regions
-    for (uint loopregion=0; loopregion < _receptor._vregion.size() ; loopregion++)
-    {
-        if (print)
-          {
-             std::cout << " Region: " << loopregion << "\n";
-          }
-
-        //calculates interaction energy between receptor copies and ligand body:
-        std::vector<dbl> Eik;
-
-        for (uint copy = 0; copy < _receptor._vregion[loopregion].size(); copy++)
+void RegionPairList::update(const AttractRigidbody& body, const Region& region)
+{
+    m_begin.clear();
+    m_atbody.clear();
+    m_atcopy.clear();
+
+    //pairs are collected up to cutoff+skin:
+    dbl listcutoff = sqrt(m_squarecutoff) + m_skin;
+    dbl squarelistcutoff = listcutoff*listcutoff;
+
+    //bounding box of all the copies:
+    Coord3D boxmin(DBL_MAX, DBL_MAX, DBL_MAX);
+    Coord3D boxmax(-DBL_MAX, -DBL_MAX, -DBL_MAX);
+    for (uint copy=0; copy<region.size(); copy++)
+        for (uint j=0; j<region[copy].Size(); j++)
         {
-            AttractPairList cpl ( lig._main, _receptor._vregion[loopregion][copy], _cutoff );
-            dbl e = _ff.nonbon8( lig._main, _receptor._vregion[loopregion][copy] , cpl );
-            Eik.push_back(e);
+            Coord3D c = region[copy].GetCoords(j);
+            boxmin.x = std::min(boxmin.x, c.x); boxmax.x = std::max(boxmax.x, c.x);
+            boxmin.y = std::min(boxmin.y, c.y); boxmax.y = std::max(boxmax.y, c.y);
+            boxmin.z = std::min(boxmin.z, c.z); boxmax.z = std::max(boxmax.z, c.z);
         }
 
+    //atoms of the body close enough to the region (one scan for all the copies):
+    std::vector<uint> candidates;
+    std::vector<Coord3D> candcoords;
+    for (uint i=0; i<body.Size(); i++)
+    {
+        if (!body.isAtomActive(i)) continue;
+        Coord3D c = body.GetCoords(i);
+        dbl dx = std::max(std::max(boxmin.x - c.x, c.x - boxmax.x), 0.0);
+        dbl dy = std::max(std::max(boxmin.y - c.y, c.y - boxmax.y), 0.0);
+        dbl dz = std::max(std::max(boxmin.z - c.z, c.z - boxmax.z), 0.0);
+        if (dx*dx + dy*dy + dz*dz <= squarelistcutoff)
+        {
+            candidates.push_back(i);
+            candcoords.push_back(c);
+        }
+    }
 
+    for (uint copy=0; copy<region.size(); copy++)
+    {
+        m_begin.push_back(m_atbody.size());
+        const AttractRigidbody& cop = region[copy];
+        for (uint j=0; j<cop.Size(); j++)
+        {
+            if (!cop.isAtomActive(j)) continue;
+            Coord3D c = cop.GetCoords(j);
+            for (uint k=0; k<candidates.size(); k++)
+            {
+                if (Norm2(candcoords[k]-c) <= squarelistcutoff)
+                {
+                    m_atbody.push_back(candidates[k]);
+                    m_atcopy.push_back(j);
+                }
+            }
+        }
+    }
+    m_begin.push_back(m_atbody.size());
+}
 
-        const dbl RT = 0.592 * 298.0 ;
 
-        //calculate weights
-        dbl sumweights = 0.0;
-        std::vector<dbl> weights;
 
-        for (uint i=0; i<Eik.size(); i++)
-        {
-            dbl e = exp( -Eik[i]/RT) ;
-            weights.push_back( e )  ;
-            sumweights += e ;
-        }
 
-        //normalize weights
+///////////////////////////////////////////////////
+//     Forcefield implementation
+///////////////////////////////////////////////////
 
-        for (uint i=0; i< weights.size(); i++)
-        {
-            weights[i] = weights[i]/sumweights ;
-            if (print) std::cout << "copy " << i << "  weight: " << weights[i] << std::endl; 
-        }
 
-        _receptor._weights[loopregion]=weights;
 
+/** \brief normalized Boltzmann weights of a set of copies
+*
+* energies are taken relative to the lowest one (log-sum-exp) so that large
+* energies neither overflow nor underflow. Copies with a weight below threshold
+* are pruned (weight 0, the others are normalized again), the lowest energy copy
+* is always kept. Returns the number of pruned copies.
+*/
+static uint boltzmannWeights(const std::vector<dbl>& energies, std::vector<dbl>& weights, dbl threshold)
+{
+    const dbl RT = 0.592 * 298.0 ;
 
+    weights.resize(energies.size());
+    if (energies.empty()) return 0;
 
+    dbl emin = *std::min_element(energies.begin(), energies.end());
 
+    dbl sumweights = 0.0;
+    for (uint i=0; i<energies.size(); i++)
+    {
+        weights[i] = exp( -(energies[i]-emin)/RT) ;
+        sumweights += weights[i] ;
     }
 
+    //normalize weights and prune the negligible ones
+    uint pruned = 0;
+    dbl kept = 0.0;
+    for (uint i=0; i< weights.size(); i++)
+    {
+        weights[i] = weights[i]/sumweights ;
+        if (weights[i] < threshold && energies[i] > emin)
+        {
+            weights[i] = 0.0;
+            pruned++;
+        }
+        else kept += weights[i];
+    }
 
+    if (pruned > 0)
+        for (uint i=0; i< weights.size(); i++)
+            weights[i] = weights[i]/kept ;
 
+    return pruned;
 }
 
 
+void McopForceField::setLigand(const Mcoprigid& lig)
+{
+    _moved_ligand = lig;
+    _initialpose = _moved_ligand.GetMatrix();
+    _ligcenter = _moved_ligand.getMain().FindCenter();
+
+    //largest distance of a ligand atom to the center, to bound the displacements:
+    _ligradius = 0.0;
+    AttractRigidbody& main = _moved_ligand.getMain();
+    for (uint i=0; i<main.Size(); i++)
+        _ligradius = std::max(_ligradius, Norm(main.GetCoords(i) - _ligcenter));
+    for (uint l=0; l<_moved_ligand.nbRegions(); l++)
+    {
+        Region& region = _moved_ligand.getRegion(l);
+        for (uint j=0; j<region.size(); j++)
+            for (uint i=0; i<region[j].Size(); i++)
+                _ligradius = std::max(_ligradius, Norm(region[j].GetCoords(i) - _ligcenter));
+    }
+
+    _centered_ligand = _moved_ligand;
+    _centered_ligand.Translate(Coord3D() - _ligcenter);
+    _pairlists_ready = false;
+}
 
 
+/// moves the ligand to the position defined by the state variables: O(1), copies are moved when accessed
+void McopForceField::setPose(const Vdouble& v)
+{
+    Mcoprigid& lig = _moved_ligand;
+    lig.ResetMatrix();
+    lig.ApplyMatrix(_initialpose);
+    lig.Translate(Coord3D() - _ligcenter);
+    lig.AttractEulerRotate(v[0], v[1], v[2]);
+    _ligtrans = Coord3D(v[3], v[4], v[5]);
+    lig.Translate(_ligcenter + _ligtrans);
+}
 
-/** \brief calculates energy of the system
-*
-* this functions returns nonbonded energy of a receptor with multicopy and a ligand without copy.
+
+/** \brief upper bound of the displacement of any ligand atom since the pairlists were built
 *
+* all the bodies of the ligand move together: an atom at distance r from the center moves by
+* at most |R1-R2| r + |t1-t2| (Frobenius norm of the difference of the rotations)
 */
-dbl McopForceField::Function(const Vdouble & v)
+dbl McopForceField::ligandDisplacement()
+{
+    Matrix pose = _moved_ligand.GetMatrix();
+    dbl rot2 = 0.0;
+    for (uint i=0; i<3; i++)
+        for (uint j=0; j<3; j++)
+        {
+            dbl d = pose(i,j) - _listpose(i,j);
+            rot2 += d*d;
+        }
+    return sqrt(rot2)*_ligradius + Norm(_ligtrans - _listtrans);
+}
+
+
+void McopForceField::setWeightsThreshold(dbl threshold)
 {
+    if (threshold < 0.0 || threshold >= 1.0)
+        throw std::invalid_argument("McopForceField::setWeightsThreshold: threshold must be in [0,1[");
+    _weights_threshold = threshold;
+}
 
-    dbl ener = 0.0 ;
-    dbl enercopy =0.0;
 
-// 1) put the objects to the right place
+void McopForceField::calculate_weights(Mcoprigid& lig, bool print)
+{
+    checkDesolvationTypes(_receptor);
+    checkDesolvationTypes(lig);
 
-    _moved_ligand = _centered_ligand;
+    //temporary pairlists (no skin) for this position of the ligand:
+    PairLists pairlists;
+    buildPairLists(lig, pairlists, 0.0);
+    computeWeights(lig, pairlists, print);
+}
 
-    Mcoprigid & lig = _moved_ligand ;
-    assert(lig._vregion.size()==0);
 
+/// checks the atom types of all the bodies of 'rigid' against the desolvation parameters of _ff
+void McopForceField::checkDesolvationTypes(Mcoprigid& rigid)
+{
+    _ff.CheckDesolvationTypes(rigid.getMain());
+    for (uint l=0; l<rigid.nbRegions(); l++)
+    {
+        Region& region = rigid.getRegion(l);
+        for (uint j=0; j<region.size(); j++)
+            _ff.CheckDesolvationTypes(region[j]);
+    }
+}
 
-    lig.AttractEulerRotate(v[0],v[1],v[2]);
-    lig.Translate(Coord3D(v[3],v[4],v[5]));
 
+void McopForceField::buildPairLists(Mcoprigid& lig, PairLists& pl, dbl skin)
+{
+    Mcoprigid& rec = _receptor;
 
-//2) calculates the energy
+    pl.main = AttractPairList(rec.getMain(), lig.getMain(), _cutoff, skin);
 
+    pl.rec.clear();
+    for (uint r=0; r<rec.nbRegions(); r++)
+        pl.rec.push_back(RegionPairList(lig.getMain(), rec.getRegion(r), _cutoff, skin));
 
-    //2.1) main ligand body with main receptor
+    pl.lig.clear();
+    for (uint l=0; l<lig.nbRegions(); l++)
+        pl.lig.push_back(RegionPairList(rec.getMain(), lig.getRegion(l), _cutoff, skin));
 
-    AttractPairList pl (_receptor._main,   lig._main, _cutoff );
-    ener += _ff.nonbon8(_receptor._main, lig._main, pl );
+    pl.cross.clear();
+    pl.crossbegin.clear();
+    pl.nligregions = lig.nbRegions();
+    for (uint r=0; r<rec.nbRegions(); r++)
+        for (uint l=0; l<lig.nbRegions(); l++)
+        {
+            pl.crossbegin.push_back(pl.cross.size());
+            for (uint j=0; j<lig.nbCopies(l); j++)
+                pl.cross.push_back(RegionPairList(lig.getCopy(l,j), rec.getRegion(r), _cutoff, skin));
+        }
+}
 
 
-    //2.2) main lignd with receptor copies:
-    assert(_receptor._vregion.size() == _receptor._weights.size());
-        
-    for (uint loopregion=0; loopregion < _receptor._vregion.size() ; loopregion++)
+/// evaluates all the tasks in parallel. Forces go to per-thread buffers of size nforces
+void McopForceField::runTasks(std::vector<Task>& tasks, uint nforces)
+{
+    //coordinates are synchronized once: bodies are then read-only for the threads
+    for (uint k=0; k<tasks.size(); k++)
     {
+        tasks[k].rec->syncCoords();
+        tasks[k].lig->syncCoords();
+    }
 
-        //calculates interaction energy between receptor copies and ligand body:
-//         std::vector<dbl> Eik;
+    int nthreads = 1;
+#ifdef _OPENMP
+    nthreads = omp_get_max_threads();
+#endif
 
+    if (nforces > 0)
+    {
+        _threadforces.resize(nthreads);
+        for (int t=0; t<nthreads; t++)
+            _threadforces[t].assign(nforces, Coord3D());
+    }
 
-        Region& ref_ensemble = _receptor._vregion[loopregion];
-        std::vector<dbl>& ref_weights = _receptor._weights[loopregion];
+    int ntasks = tasks.size();
+    #pragma omp parallel for schedule(dynamic,1)
+    for (int k=0; k<ntasks; k++)
+    {
+        int thread = 0;
+#ifdef _OPENMP
+        thread = omp_get_thread_num();
+#endif
+        Task& task = tasks[k];
+        Coord3D* forces = (task.forces != Task::energyOnly) ? &_threadforces[thread][task.forces] : 0;
+        task.energy = _ff.nonbon8_pairs(*task.rec, *task.lig, task.atrec, task.atlig, task.npairs,
+                                        task.squarecutoff, task.weight, 0, forces);
+    }
+}
 
-        assert( ref_ensemble.size() == ref_weights.size());
 
-        for (uint copynb = 0; copynb < ref_ensemble.size(); copynb++)
+void McopForceField::computeWeights(Mcoprigid& lig, PairLists& pl, bool print)
+{
+    Mcoprigid& rec = _receptor;
+    const uint nR = rec.nbRegions();
+    const uint nL = lig.nbRegions();
+
+    //energies of every copy with the main body of the partner, and of every pair of copies:
+    std::vector<Task> tasks;
+    for (uint r=0; r<nR; r++)
+        for (uint i=0; i<rec.nbCopies(r); i++)
         {
+            Task task = {&rec.getCopy(r,i), &lig.getMain(), pl.rec[r].CopyAtoms(i), pl.rec[r].BodyAtoms(i), pl.rec[r].Size(i),
+                         pl.rec[r].GetSquareCutoff(), 0.0, Task::energyOnly, 0.0};
+            tasks.push_back(task);
+        }
+    for (uint l=0; l<nL; l++)
+        for (uint j=0; j<lig.nbCopies(l); j++)
+        {
+            Task task = {&rec.getMain(), &lig.getCopy(l,j), pl.lig[l].BodyAtoms(j), pl.lig[l].CopyAtoms(j), pl.lig[l].Size(j),
+                         pl.lig[l].GetSquareCutoff(), 0.0, Task::energyOnly, 0.0};
+            tasks.push_back(task);
+        }
+    for (uint r=0; r<nR; r++)
+        for (uint l=0; l<nL; l++)
+            for (uint j=0; j<lig.nbCopies(l); j++)
+            {
+                RegionPairList& cpl = pl.cross[pl.crossIndex(r,l)+j];
+                for (uint i=0; i<rec.nbCopies(r); i++)
+                {
+                    Task task = {&rec.getCopy(r,i), &lig.getCopy(l,j), cpl.CopyAtoms(i), cpl.BodyAtoms(i), cpl.Size(i),
+                                 cpl.GetSquareCutoff(), 0.0, Task::energyOnly, 0.0};
+                    tasks.push_back(task);
+                }
+            }
+
+    runTasks(tasks, 0);
+
+    uint k = 0;
+    uint pruned = 0;
+    std::vector< std::vector<dbl> > Erec(nR);
+    for (uint r=0; r<nR; r++)
+    {
+        for (uint i=0; i<rec.nbCopies(r); i++)
+            Erec[r].push_back(tasks[k++].energy);
+        pruned += boltzmannWeights(Erec[r], rec._weights[r], _weights_threshold);
+    }
 
-            dbl& weight = ref_weights[copynb];
-            AttractRigidbody& copy = ref_ensemble[copynb];
+    std::vector< std::vector<dbl> > Elig(nL);
+    _ligweights.resize(nL);
+    for (uint l=0; l<nL; l++)
+    {
+        for (uint j=0; j<lig.nbCopies(l); j++)
+            Elig[l].push_back(tasks[k++].energy);
+        pruned += boltzmannWeights(Elig[l], _ligweights[l], _weights_threshold);
+    }
 
-            AttractPairList cpl ( lig._main, copy, _cutoff );
-            std::vector<Coord3D> copyforce(copy.Size());
-            std::vector<Coord3D> mainforce(lig._main.Size());
+    //joint weights: Boltzmann factor of the whole energy of each pair of copies
+    _jointweights.resize(nR*nL);
+    for (uint r=0; r<nR; r++)
+        for (uint l=0; l<nL; l++)
+        {
+            uint ni = rec.nbCopies(r);
+            uint nj = lig.nbCopies(l);
+            std::vector<dbl> Ejoint(ni*nj);
+            for (uint j=0; j<nj; j++)
+                for (uint i=0; i<ni; i++)
+                    Ejoint[i*nj+j] = Erec[r][i] + Elig[l][j] + tasks[k++].energy;
+            pruned += boltzmannWeights(Ejoint, _jointweights[r*nL+l], _weights_threshold);
+        }
 
-//             dbl e = _ff.nonbon8( lig._main, _receptor._vregion[loopregion][copy] , cpl );
-            dbl e = _ff.nonbon8_forces(lig._main, copy, cpl, mainforce, copyforce);
-            enercopy += e * weight;//lig._weights[loopregion][copy];
+    if (print)
+    {
+        for (uint r=0; r<nR; r++)
+        {
+            std::cout << " Region: " << r << "\n";
+            for (uint i=0; i<rec._weights[r].size(); i++)
+                std::cout << "copy " << i << "  weight: " << rec._weights[r][i] << std::endl;
+        }
+        for (uint l=0; l<nL; l++)
+        {
+            std::cout << " Ligand region: " << l << "\n";
+            for (uint j=0; j<_ligweights[l].size(); j++)
+                std::cout << "copy " << j << "  weight: " << _ligweights[l][j] << std::endl;
+        }
+        std::cout << pruned << " weights below " << _weights_threshold << " pruned" << std::endl;
+    }
+}
 
-            //multiply forces by copy weight:
-            for(uint i=0; i<copyforce.size(); i++)
-            { copyforce[i] = weight*copyforce[i]; }
-            for(uint i=0; i<mainforce.size(); i++)
-            { mainforce[i] = weight*mainforce[i]; }
 
-            //add force to main ligand and receptor copy
-            assert(lig._main.Size() == mainforce.size());
-            for (uint i=0; i<lig._main.Size(); i++)
-               lig._main.m_forces[i]+=mainforce[i];
+void McopForceField::initMinimization()
+{
+    //ligand at its starting position (null state variables):
+    setPose(Vdouble(6, 0.0));
+    _ncalls = 0;
+    updatePairLists(true);
+}
 
-            assert(copy.Size()==copyforce.size());
-            for(uint i=0; i<copyforce.size(); i++)
-               copy.m_forces[i]+=copyforce[i];
 
+/** \brief rebuilds the pairlists of the moved ligand if needed (or if force is true)
+*
+* the receptor is fixed: all the pairlists are rebuilt at once when a ligand atom may
+* have moved by more than the skin. Weights are recomputed with the new pairlists,
+* or every _weights_interval calls.
+*/
+void McopForceField::updatePairLists(bool force)
+{
+    Mcoprigid& lig = _moved_ligand;
+    bool rebuild = force || !_pairlists_ready || ligandDisplacement() > _skin;
 
+    if (rebuild)
+    {
+        //exceptions cannot leave the parallel region of runTasks(): checked here
+        checkDesolvationTypes(_receptor);
+        checkDesolvationTypes(lig);
+        buildPairLists(lig, _pairlists, _skin);
+        _listpose = lig.GetMatrix();
+        _listtrans = _ligtrans;
+
+        //offsets of the ligand bodies in the force buffers:
+        _ligoffsets.clear();
+        _ligregionfirst.clear();
+        _ligoffsets.push_back(0);
+        _ligoffsets.push_back(lig.getMain().Size());
+        for (uint l=0; l<lig.nbRegions(); l++)
+        {
+            _ligregionfirst.push_back(_ligoffsets.size()-1);
+            for (uint j=0; j<lig.nbCopies(l); j++)
+                _ligoffsets.push_back(_ligoffsets.back() + lig.getCopy(l,j).Size());
         }
 
-
+        _pairlists_ready = true;
     }
 
-    return ener + enercopy;
-
+    if (rebuild || (_weights_interval > 0 && _ncalls % _weights_interval == 0))
+        computeWeights(lig, _pairlists, false);
 }
 
 
-void McopForceField::Derivatives(const Vdouble& v, Vdouble & g )
+/// ligand body of index k in _ligoffsets (0: main body)
+AttractRigidbody& McopForceField::ligandBody(Mcoprigid& lig, uint k)
 {
+    if (k == 0) return lig.getMain();
+    uint l = std::upper_bound(_ligregionfirst.begin(), _ligregionfirst.end(), k) - _ligregionfirst.begin() - 1;
+    return lig.getCopy(l, k - _ligregionfirst[l]);
+}
 
-//sum the forces over x, y and z:
 
-Coord3D ligtransForces; //translational forces for the ligand:
-for(uint i=0; i<_moved_ligand._main.Size(); i++)
- {
-     ligtransForces += _moved_ligand._main.m_forces[i];
- }
 
 
-Coord3D receptortransForces;
-for(uint i=0; i<_receptor._main.Size(); i++)
+
+/** \brief calculates energy of the system
+*
+* All the copies of a region share one RegionPairList and are evaluated in a single
+* pass, forces being multiplied by the copy weight on the fly.
+* Pairlists are kept from one call to the other and rebuilt when the ligand moved by
+* more than the skin. Moving the ligand does not depend on its number of copies:
+* only the copies with a non-null weight are moved and evaluated.
+*/
+dbl McopForceField::Function(const Vdouble & v)
 {
-receptortransForces+= _receptor._main.m_forces[i];
-}
 
+// 1) put the objects to the right place
+
+    setPose(v);
+    updatePairLists(false);
+    _ncalls++;
 
-for (uint i=0; i <_receptor._vregion.size(); i++)
- {
-   Region& ens = _receptor._vregion[i];
-   std::vector<dbl> & weights =  _receptor._weights[i];
+    Mcoprigid& lig = _moved_ligand;
+    Mcoprigid& rec = _receptor;
+    PairLists& pl = _pairlists;
+    const uint nR = rec.nbRegions();
+    const uint nL = lig.nbRegions();
 
-   for(uint j=0; j<ens.size(); j++)
-   {
-     AttractRigidbody& copy = ens[j];
-       for (uint atomnb=0; atomnb < copy.Size(); ++atomnb)
-       {
-            receptortransForces += weights[j] * copy.m_forces[atomnb];
-       }
+    assert(nR == rec._weights.size());
 
-   }
 
-//TODO DEBUG:
-std::cout << "differences between the two forces: " <<  (ligtransForces - receptortransForces).toString() << std::endl ;
+//2) list of the interactions
 
- }
+    _tasks.clear();
+    _ligused.assign(_ligoffsets.size()-1, false);
 
+    //2.1) main ligand body with main receptor
+    AttractRigidbody& ligmain = lig.getMain();
+    AttractRigidbody& recmain = rec.getMain();
+    Task mainTask = {&recmain, &ligmain, pl.main.ReceptorAtoms(), pl.main.LigandAtoms(), pl.main.Size(),
+                     pl.main.GetSquareCutoff(), 1.0, _ligoffsets[0], 0.0};
+    _tasks.push_back(mainTask);
+    _ligused[0] = true;
+
+    //2.2) main ligand with receptor copies
+    for (uint r=0; r<nR; r++)
+        for (uint i=0; i<rec.nbCopies(r); i++)
+        {
+            if (rec._weights[r][i] == 0.0) continue; //pruned copy
+            Task task = {&rec.getCopy(r,i), &ligmain, pl.rec[r].CopyAtoms(i), pl.rec[r].BodyAtoms(i), pl.rec[r].Size(i),
+                         pl.rec[r].GetSquareCutoff(), rec._weights[r][i], _ligoffsets[0], 0.0};
+            _tasks.push_back(task);
+        }
 
+    //2.3) main receptor with ligand copies
+    for (uint l=0; l<nL; l++)
+        for (uint j=0; j<lig.nbCopies(l); j++)
+        {
+            if (_ligweights[l][j] == 0.0) continue;
+            uint k = _ligregionfirst[l]+j;
+            Task task = {&recmain, &lig.getCopy(l,j), pl.lig[l].BodyAtoms(j), pl.lig[l].CopyAtoms(j), pl.lig[l].Size(j),
+                         pl.lig[l].GetSquareCutoff(), _ligweights[l][j], _ligoffsets[k], 0.0};
+            _tasks.push_back(task);
+            _ligused[k] = true;
+        }
 
+    //2.4) receptor copies with ligand copies (joint weights)
+    for (uint r=0; r<nR; r++)
+        for (uint l=0; l<nL; l++)
+        {
+            std::vector<dbl>& joint = _jointweights[r*nL+l];
+            uint nj = lig.nbCopies(l);
+            for (uint j=0; j<nj; j++)
+            {
+                RegionPairList& cpl = pl.cross[pl.crossIndex(r,l)+j];
+                uint k = _ligregionfirst[l]+j;
+                for (uint i=0; i<rec.nbCopies(r); i++)
+                {
+                    if (joint[i*nj+j] == 0.0) continue;
+                    Task task = {&rec.getCopy(r,i), &lig.getCopy(l,j), cpl.CopyAtoms(i), cpl.BodyAtoms(i), cpl.Size(i),
+                                 cpl.GetSquareCutoff(), joint[i*nj+j], _ligoffsets[k], 0.0};
+                    _tasks.push_back(task);
+                    _ligused[k] = true;
+                }
+            }
+        }
 
 
+//3) energy and forces on the ligand
+
+    runTasks(_tasks, _ligoffsets.back());
+
+    dbl ener = 0.0;
+    for (uint k=0; k<_tasks.size(); k++)
+        ener += _tasks[k].weight * _tasks[k].energy;
+
+    //sum of the per-thread forces, for the bodies that were evaluated:
+    for (uint k=0; k<_ligused.size(); k++)
+    {
+        if (!_ligused[k]) continue;
+        AttractRigidbody& body = ligandBody(lig, k);
+        body.resetForces();
+        for (uint t=0; t<_threadforces.size(); t++)
+        {
+            const std::vector<Coord3D>& forces = _threadforces[t];
+            for (uint a=0; a<body.Size(); a++)
+                body.m_forces[a] += forces[_ligoffsets[k]+a];
+        }
+    }
+
+    return ener;
+
+}
+
+
+/** \brief analytic derivatives of the energy wrt the ligand state variables
+*
+* Must follow a call to Function() with the same state variables. The main body and
+* the copies of the ligand move together: their (already weighted) forces are reduced
+* into the same rotational and translational derivatives.
+* The weights are considered constant between two updates.
+*/
+void McopForceField::Derivatives(const Vdouble& v, Vdouble & g )
+{
+    for (uint i=0; i<6; i++)
+        g[i] = 0.0;
+
+    for (uint k=0; k<_ligused.size(); k++)
+    {
+        if (!_ligused[k]) continue; //no force on this copy
+        AttractRigidbody& body = ligandBody(_moved_ligand, k);
+        BaseAttractForceField::addRotaForces(ligandBody(_centered_ligand, k), body, v[0], v[1], v[2], g, 0);
+        BaseAttractForceField::addTransForces(body, g, 3);
+    }
+
+    BaseAttractForceField::reduceTransForces(g, 3);
 }
 
 
@@ -48,12 +48,62 @@ public:
 
 
    AttractRigidbody& operator[](uint i){return _copies[i];};
+   const AttractRigidbody& operator[](uint i) const {return _copies[i];};
+
+};
+
+
+
+/*! \brief pairlist between one body and all the copies of a Region
+*
+*   copies of a region occupy nearly the same space: their pairs are collected
+*   in a single list, sorted by copy (pairs of copy i are stored between
+*   Begin(i) and Begin(i+1)). Atoms of the body further than the cutoff from
+*   the bounding box of the region are discarded once for all the copies.
+*
+*   As for AttractPairList, pairs may be collected up to cutoff+skin so that the
+*   list remains valid until the atoms moved by more than the skin (checked by
+*   McopForceField::updatePairLists() from the ligand displacement).
+*/
+class RegionPairList
+{
+public:
+
+    RegionPairList(){};
+    RegionPairList(const AttractRigidbody& body, const Region& region, dbl cutoff, dbl skin=0.0);
+
+    void update(const AttractRigidbody& body, const Region& region);
+
+    uint Begin(uint copy) const {return m_begin[copy];}; ///< first pair of a copy
+    uint Size(uint copy) const {return m_begin[copy+1]-m_begin[copy];}; ///< number of pairs of a copy
+    uint Size() const {return m_atbody.size();};
+
+    const uint* BodyAtoms(uint copy) const {return m_atbody.empty() ? 0 : &m_atbody[0] + m_begin[copy];}; ///< atoms of the body, pairs of a copy
+    const uint* CopyAtoms(uint copy) const {return m_atcopy.empty() ? 0 : &m_atcopy[0] + m_begin[copy];}; ///< atoms of the copy
+
+    dbl GetSquareCutoff() const {return m_squarecutoff;};
+
+private:
+
+    dbl m_squarecutoff;
+    dbl m_skin;
+
+    std::vector<uint> m_begin; ///< size: number of copies + 1
+    std::vector<uint> m_atbody;
+    std::vector<uint> m_atcopy;
 
 };
 
 
 
 
+/*! \brief multicopy rigidbody
+*
+*   a main body and regions of alternative copies. Rotations and translations
+*   only update one matrix shared by all the bodies: it is applied to a body
+*   the first time this body is accessed after a move, so that moving the
+*   object costs the same whatever the number of copies.
+*/
 class Mcoprigid //multicopy rigidbody
 {
 
@@ -64,11 +114,26 @@ public:
     //using default copy operator
 
     void setMain(AttractRigidbody& main) ;
-    void addEnsemble(const Region& reg){ _vregion.push_back(reg); std::vector<dbl> v; _weights.push_back(v);  };
+    void addEnsemble(const Region& reg);
 
 
     void AttractEulerRotate(const dbl& phi, const dbl& ssi, const dbl& rot);
     void Translate(const Coord3D& c);
+    void ApplyMatrix(const Matrix& mat);
+    /// back to the initial position of the bodies
+    void ResetMatrix();
+    /// transformation applied to all the bodies
+    Matrix GetMatrix() {return _pose.GetMatrix();};
+
+    /// main body at the current position
+    AttractRigidbody& getMain() {sync(_main, _mainpose); return _main;};
+    /// copy of a region at the current position
+    AttractRigidbody& getCopy(uint region, uint copy) {sync(_vregion[region][copy], _copypose[region][copy]); return _vregion[region][copy];};
+    /// all the copies of a region at the current position
+    Region& getRegion(uint region);
+
+    uint nbRegions() const {return _vregion.size();};
+    uint nbCopies(uint region) const {return _vregion[region].size();};
 
 
     void PrintWeights();
@@ -77,6 +142,16 @@ public:
 
 private:
 
+    /// position of one body
+    struct BodyPose
+    {
+        Matrix initial; ///< matrix of the body when added
+        uint stamp; ///< value of _posestamp when the body was last moved
+    };
+
+    void sync(AttractRigidbody& body, BodyPose& pose);
+    BodyPose newPose(AttractRigidbody& body);
+
     AttractRigidbody _main;
     std::vector< Region > _vregion ;
 
@@ -85,6 +160,13 @@ private:
 
     std::vector< std::vector <dbl> > _weights;
 
+    Rigidbody _pose; ///< transformation shared by all the bodies (holds no atom)
+    uint _posestamp; ///< incremented at each move
+    Matrix _posematrix; ///< _pose for the stamp _posematrixstamp
+    uint _posematrixstamp;
+    BodyPose _mainpose;
+    std::vector< std::vector<BodyPose> > _copypose;
+
     friend class McopForceField;
 
 };
@@ -94,6 +176,16 @@ private:
 /** \brief ForceField with multicopy
 needs an attract forcefield (either 1 or 2) in constructor
 
+Both the receptor and the ligand may carry copy regions. The energy is the sum of
+- main receptor / main ligand
+- receptor copies / main ligand, weighted by the receptor copy weights
+- main receptor / ligand copies, weighted by the ligand copy weights
+- receptor copies / ligand copies, weighted by joint weights computed from the
+  Boltzmann factor of the three terms above for each pair of copies.
+
+The interactions of every (body, region) pair are independent tasks evaluated in
+parallel (OpenMP). The receptor is fixed: only forces on the ligand are computed.
+
 no normal modes yet
 */
 class McopForceField: public ForceField
@@ -101,36 +193,107 @@ class McopForceField: public ForceField
 
 public:
 
-    McopForceField(BaseAttractForceField& ff, dbl cutoff)
-            :_ff(ff), _cutoff(cutoff) {};
+    McopForceField(BaseAttractForceField& ff, dbl cutoff, dbl skin=2.0)
+            :_ff(ff), _cutoff(cutoff), _skin(skin), _pairlists_ready(false), _weights_interval(0), _weights_threshold(1e-8), _ncalls(0) {};
 
 
     dbl Function(const Vdouble&);
     void Derivatives(const Vdouble& v, Vdouble & g );
 
 
-    void setReceptor(const Mcoprigid& rec) {_receptor = rec;};
-    void setLigand(const Mcoprigid& lig) { _centered_ligand = lig;  };
+    void setReceptor(const Mcoprigid& rec) {_receptor = rec; _pairlists_ready = false;};
+    ///the ligand is rotated around its center: null state variables give its initial position
+    void setLigand(const Mcoprigid& lig);
 
     void calculate_weights(Mcoprigid& lig, bool print=false);
+    ///weights of the receptor copies, for each region
+    std::vector <std::vector<dbl> > getReceptorWeights() const {return _receptor._weights;};
+    ///weights of the ligand copies, for each region
+    std::vector <std::vector<dbl> > getLigandWeights() const {return _ligweights;};
+    ///joint weights of the copies of receptor region r and ligand region l (index i*nj+j, nj copies of l)
+    std::vector<dbl> getJointWeights(uint r, uint l) const {return _jointweights.at(r*_ligweights.size()+l);};
+
+    /// during a minimization weights are recomputed when a pairlist is rebuilt
+    /// and, if interval > 0, every 'interval' calls to Function()
+    void setWeightsUpdate(uint interval) {_weights_interval = interval;};
+    /// copies with a weight below threshold are skipped until the next weights update
+    void setWeightsThreshold(dbl threshold);
 
     uint ProblemSize() {return 6;};
-    void initMinimization(){};
+    ///builds the pairlists (with a skin) and the weights for the ligand at its starting position
+    void initMinimization();
 
 private:
 
+    /// pairlists between the bodies of the receptor and of the ligand
+    struct PairLists
+    {
+        AttractPairList main; ///< receptor main / ligand main
+        std::vector<RegionPairList> rec; ///< ligand main / receptor region r
+        std::vector<RegionPairList> lig; ///< receptor main / ligand region l
+        std::vector<RegionPairList> cross; ///< copy j of ligand region l / receptor region r: index crossIndex(r,l)+j
+        std::vector<uint> crossbegin;
+        uint nligregions;
+
+        uint crossIndex(uint r, uint l) const {return crossbegin[r*nligregions+l];};
+    };
+
+    /// one interaction between a receptor body and a ligand body
+    struct Task
+    {
+        static const uint energyOnly = uint(-1);
+
+        AttractRigidbody* rec;
+        AttractRigidbody* lig;
+        const uint* atrec;
+        const uint* atlig;
+        uint npairs;
+        dbl squarecutoff;
+        dbl weight;
+        uint forces; ///< offset of lig in the force buffers, energyOnly: no force
+        dbl energy; ///< unweighted energy (output)
+    };
+
+    void setPose(const Vdouble& v);
+    dbl ligandDisplacement();
+    void checkDesolvationTypes(Mcoprigid& rigid);
+    void buildPairLists(Mcoprigid& lig, PairLists& pl, dbl skin);
+    void updatePairLists(bool force);
+    void computeWeights(Mcoprigid& lig, PairLists& pl, bool print);
+    void runTasks(std::vector<Task>& tasks, uint nforces);
+    AttractRigidbody& ligandBody(Mcoprigid& lig, uint k);
+
     BaseAttractForceField& _ff ;
     dbl _cutoff;
+    dbl _skin;
 
-    bool _update_weights;
+    //pairlists between the moved ligand and the receptor, owned by the forcefield:
+    bool _pairlists_ready;
+    PairLists _pairlists;
+    Matrix _listpose; ///< transformation of the ligand when the pairlists were built
+    Coord3D _listtrans;
 
-    Mcoprigid _centered_ligand ;
-    Mcoprigid _moved_ligand ;
-    Mcoprigid _receptor;
+    uint _weights_interval;
+    dbl _weights_threshold;
+    uint _ncalls;
 
+    std::vector< std::vector<dbl> > _ligweights; ///< weights of the ligand copies
+    std::vector< std::vector<dbl> > _jointweights; ///< receptor region r / ligand region l: index i*nl+j for copies i and j
 
-    
+    std::vector<uint> _ligoffsets; ///< offset of each ligand body (main, then copies) in the force buffers
+    std::vector<uint> _ligregionfirst; ///< index in _ligoffsets of the first copy of each ligand region
+    std::vector<bool> _ligused; ///< ligand bodies evaluated by the last call to Function()
+    std::vector<Task> _tasks;
+    std::vector< std::vector<Coord3D> > _threadforces; ///< per-thread force buffers
 
+    Matrix _initialpose; ///< transformation of the ligand given to setLigand()
+    Coord3D _ligcenter; ///< center of the main body of the ligand given to setLigand()
+    dbl _ligradius; ///< largest distance of a ligand atom (all copies) to _ligcenter
+    Coord3D _ligtrans; ///< current translation of the ligand
+
+    Mcoprigid _centered_ligand ;
+    Mcoprigid _moved_ligand ;
+    Mcoprigid _receptor;
 
 };
 
@@ -4,6 +4,7 @@
 #include <iostream>
 #include <math.h>
 #include <float.h>
+#include <stdexcept>
 
 //#include "../complexify.h"
 
@@ -26,6 +27,7 @@ Lbfgs::Lbfgs( ForceField& toMinim)
     //let the object do some initialization before beginning a new minimization
     //(for example, create new pairlists...)
     m_opt = NULL;
+    m_history_size = 0;
     objToMinimize.initMinimization();
 };
 
@@ -36,6 +38,78 @@ Lbfgs::~Lbfgs()
 }
 
 
+void Lbfgs::SetStartingPoint(const std::vector<double>& x0)
+{
+    if (x0.size() != objToMinimize.ProblemSize())
+        throw std::invalid_argument("Lbfgs::SetStartingPoint: wrong number of variables");
+    m_x0 = x0;
+}
+
+
+void Lbfgs::initBounds()
+{
+    uint n = objToMinimize.ProblemSize();
+    if (m_nbd.size() == n) return;
+    m_lower = std::vector<double>(n, 0.0);
+    m_upper = std::vector<double>(n, 0.0);
+    m_nbd = Vint(n, 0);
+}
+
+
+void Lbfgs::SetBounds(uint i, double lower, double upper)
+{
+    initBounds();
+    if (i >= m_nbd.size()) throw std::out_of_range("Lbfgs::SetBounds: variable index out of range");
+    if (lower > upper)
+        throw std::invalid_argument("Lbfgs::SetBounds: lower bound greater than upper bound");
+    m_lower[i] = lower;
+    m_upper[i] = upper;
+    m_nbd[i] = 2;
+}
+
+
+void Lbfgs::SetLowerBound(uint i, double lower)
+{
+    initBounds();
+    if (i >= m_nbd.size()) throw std::out_of_range("Lbfgs::SetLowerBound: variable index out of range");
+    if ((m_nbd[i] == 2 || m_nbd[i] == 3) && lower > m_upper[i])
+        throw std::invalid_argument("Lbfgs::SetLowerBound: lower bound greater than upper bound");
+    m_lower[i] = lower;
+    if (m_nbd[i] == 0) m_nbd[i] = 1;
+    else if (m_nbd[i] == 3) m_nbd[i] = 2;
+}
+
+
+void Lbfgs::SetUpperBound(uint i, double upper)
+{
+    initBounds();
+    if (i >= m_nbd.size()) throw std::out_of_range("Lbfgs::SetUpperBound: variable index out of range");
+    if ((m_nbd[i] == 1 || m_nbd[i] == 2) && upper < m_lower[i])
+        throw std::invalid_argument("Lbfgs::SetUpperBound: upper bound lower than lower bound");
+    m_upper[i] = upper;
+    if (m_nbd[i] == 0) m_nbd[i] = 3;
+    else if (m_nbd[i] == 1) m_nbd[i] = 2;
+}
+
+
+void Lbfgs::ClearBounds()
+{
+    m_lower.clear();
+    m_upper.clear();
+    m_nbd.clear();
+}
+
+
+void Lbfgs::SetHistory(const Lbfgs& previous)
+{
+    if (previous.m_history_size > 0 && previous.m_history_s.size() != previous.m_history_size*objToMinimize.ProblemSize())
+        throw std::invalid_argument("Lbfgs::SetHistory: the previous minimization has a different number of variables");
+    m_history_size = previous.m_history_size;
+    m_history_s = previous.m_history_s;
+    m_history_y = previous.m_history_y;
+}
+
+
 // vector<double> to vector<double> converter. used for genericity. should not impact performances too much.
 inline void tocplx(const std::vector<double> & vdblin, std::vector<double> & vdblout ){vdblout=vdblin;};
 
@@ -76,21 +150,16 @@ void Lbfgs::minimize(int maxiter)
     std::cout  << "number of free variables for the minimizer: " << n << std::endl;
 
 
-    std::vector<double> l(n);
-    std::vector<double> u(n);
-    Vint nbd(n);
+    initBounds();
 
     x.resize(n);
     g.resize(n);
 
     for (int i=0;i<n; i++)
     {
-        l[i]=0;
-        u[i]=0;
-        nbd[i]=0;
-        x[i] = 0.0;
+        x[i] = m_x0.empty() ? 0.0 : m_x0[i];
         g[i] = 0.0;
-    }  //unconstrained problem
+    }
 
 
 
@@ -98,7 +167,8 @@ void Lbfgs::minimize(int maxiter)
 
     int m = 5;
 
-    m_opt = lbfgsb_create(n, m, &l[0], &u[0], &nbd[0]);
+    if (m_opt) lbfgsb_destroy(m_opt);
+    m_opt = lbfgsb_create(n, m, &m_lower[0], &m_upper[0], &m_nbd[0]);
     assert(m_opt);
 
 
@@ -109,6 +179,7 @@ void Lbfgs::minimize(int maxiter)
     m_opt->max_iter = maxiter;
 
     int last_iter = 0;
+    bool warmstart = (m_history_size > 0);
 
     /*    opt->iprint = 0;*/
     while (1) {
@@ -120,6 +191,13 @@ void Lbfgs::minimize(int maxiter)
             break;
         } else if (rc == 1) {
 
+            if (warmstart)
+            {
+                //first call: the minimizer is initialized, the history can be injected
+                warmstart = false;
+                if (lbfgsb_set_history(m_opt, m_history_size, &m_history_s[0], &m_history_y[0]) < 0)
+                    std::cout << "Lbfgs: history rejected, cold start\n";
+            }
 
 
 /*
@@ -188,6 +266,13 @@ void Lbfgs::minimize(int maxiter)
 
     m_opt->task[59]='\0'; //add a null terminating character to task[]
 
+    //keep the correction pairs for a future warm start
+    m_history_s.resize(m*n);
+    m_history_y.resize(m*n);
+    m_history_size = lbfgsb_get_history(m_opt, &m_history_s[0], &m_history_y[0]);
+    m_history_s.resize(m_history_size*n);
+    m_history_y.resize(m_history_size*n);
+
 
     std::cout << m_opt->task  << " |  " << m_opt->niter << " iterations\n";
 }
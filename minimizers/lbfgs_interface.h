@@ -16,7 +16,7 @@ namespace PTools
 
 
 // new version, from sdrive.c
-// no bounds !!
+// variables are unbounded unless SetBounds/SetLowerBound/SetUpperBound are used
 class Lbfgs
 {
       public:
@@ -28,6 +28,23 @@ class Lbfgs
             std::vector<double> GetMinimizedVarsAtIter(uint iter);
             int GetNumberIter() {return m_opt->niter;}
 
+            /// start the next minimize() from x0 instead of 0
+            void SetStartingPoint(const std::vector<double>& x0);
+
+            /// warm start: reuse the (s,y) correction pairs of a previous minimization
+            /// (previous cutoff stage, neighbouring starting position...).
+            /// Compatible with bounds: variables at a bound leave the free set at the first iteration
+            void SetHistory(const Lbfgs& previous);
+            /// number of correction pairs kept at the end of the last minimize()
+            uint GetHistorySize() const {return m_history_size;}
+
+            /// box constraint lower <= x[i] <= upper for the next minimize()
+            void SetBounds(uint i, double lower, double upper);
+            void SetLowerBound(uint i, double lower); ///< x[i] >= lower (must not exceed the upper bound of x[i])
+            void SetUpperBound(uint i, double upper); ///< x[i] <= upper (must not be below the lower bound of x[i])
+            /// all the variables are unbounded again
+            void ClearBounds();
+
 
 
       private:
@@ -38,6 +55,19 @@ class Lbfgs
 
             lbfgsb_t* m_opt; //minimizer structure
 
+            std::vector<double> m_x0; // starting point (empty: 0)
+
+            // bounds, in the lbfgsb convention (nbd: 0 none, 1 lower, 2 both, 3 upper)
+            std::vector<double> m_lower;
+            std::vector<double> m_upper;
+            Vint m_nbd;
+            void initBounds();
+
+            // correction pairs, oldest first (pair i starts at i*n)
+            uint m_history_size;
+            std::vector<double> m_history_s;
+            std::vector<double> m_history_y;
+
             std::vector<std::vector<double> > m_vars_over_time;
 
 
@@ -68,6 +68,10 @@ lbfgsb_t* lbfgsb_create(int n, int m, double* l, double* u, int* nbd);
 int lbfgsb_run(lbfgsb_t* obj, double* x, double* f, double* g);
 void lbfgsb_destroy(lbfgsb_t* obj);
 
+/* warm start: see the comments in lbfgsb_wrapper.c */
+int lbfgsb_get_history(const lbfgsb_t* obj, double* s, double* y);
+int lbfgsb_set_history(lbfgsb_t* obj, int k, const double* s, const double* y);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -57,6 +57,9 @@ extern void lbfgsb_FUN(int* n, int* m, double* x, double* l, double* u,
         double* wa, int* iwa, char* task, int* iprint, char* csave, int*
         lsave, int* isave, double* dsave);
 
+extern void formt_(int* m, double* wt, double* sy, double* ss, int* col,
+        double* theta, int* info);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -87,7 +90,7 @@ lbfgsb_t* lbfgsb_create(int n, int m, double* l, double* u, int* nbd) {
         return 0;
     }
 
-    opt->wa = (double*)malloc(sizeof(double) * ((2*m+4)*n + 11*m*m + 8*m));
+    opt->wa = (double*)malloc(sizeof(double) * ((2*m+4)*n + 12*m*m + 12*m)); /* see setulb */
     if (!opt->wa) {
         free(opt->iwa);
         free(opt);
@@ -194,3 +197,160 @@ int lbfgsb_run(lbfgsb_t* opt, double* x, double* f, double* g) {
     }
 }
 
+
+
+/* Limited memory history (warm start)
+ *
+ * The Fortran routine keeps the correction pairs s_i = x_{i+1} - x_i and
+ * y_i = g_{i+1} - g_i in the ws and wy arrays of the working space wa
+ * (circular buffers of m columns starting at column 'head').
+ * Offsets in wa are stored by setulb in isave(4..20), the local variables of
+ * mainlb are stored in isave(22..44), dsave and lsave.
+ */
+
+/* wa offsets (0-based) */
+#define LB_WS(o)   ((o)->wa + (o)->isave[3] - 1)
+#define LB_WY(o)   ((o)->wa + (o)->isave[4] - 1)
+#define LB_SY(o)   ((o)->wa + (o)->isave[5] - 1)
+#define LB_SS(o)   ((o)->wa + (o)->isave[6] - 1)
+#define LB_WT(o)   ((o)->wa + (o)->isave[8] - 1)
+#define LB_SND(o)  ((o)->wa + (o)->isave[10] - 1)
+
+/* local variables of mainlb */
+#define LB_HEAD    26
+#define LB_COL     27
+#define LB_ITAIL   28
+#define LB_ITER    29
+#define LB_IUPDAT  30
+#define LB_NFREE   37
+#define LB_ILEAVE  39
+#define LB_NENTER  40
+
+static double dot(int n, const double* a, const double* b) {
+    int i;
+    double sum = 0.0;
+    for (i = 0; i < n; ++i)
+        sum += a[i]*b[i];
+    return sum;
+}
+
+/* copy the correction pairs currently stored by the minimizer, oldest first.
+ * s and y must hold m*n doubles (pair i starts at i*n) or be NULL.
+ * returns the number of pairs.
+ */
+int lbfgsb_get_history(const lbfgsb_t* opt, double* s, double* y) {
+    int n = opt->n;
+    int m = opt->m;
+    int col, head, i, p;
+
+    if (strncmp(opt->task, "START", 5) == 0)
+        return 0; /* setulb has never been called */
+
+    col = opt->isave[LB_COL];
+    head = opt->isave[LB_HEAD];
+    if (s && y) {
+        for (i = 0; i < col; ++i) {
+            p = (head - 1 + i) % m;
+            memcpy(s + i*n, LB_WS(opt) + p*n, n*sizeof(double));
+            memcpy(y + i*n, LB_WY(opt) + p*n, n*sizeof(double));
+        }
+    }
+    return col;
+}
+
+/* replace the (empty) history of a new minimization by k correction pairs,
+ * oldest first (pair i starts at s + i*n and y + i*n).
+ * Only the m last pairs with a positive curvature s.y are kept.
+ *
+ * Must be called after the first call to lbfgsb_run(), when the minimizer
+ * asks for the function at the starting point (task = FG_START).
+ * returns the number of pairs actually used, or -1 if the history was rejected.
+ */
+int lbfgsb_set_history(lbfgsb_t* opt, int k, const double* s, const double* y) {
+    int n = opt->n;
+    int m = opt->m;
+    int m2 = 2*m;
+    int* keep;
+    int col, first, i, j, info;
+    double sy, yy;
+    double* ws = LB_WS(opt);
+    double* wy = LB_WY(opt);
+    double* msy = LB_SY(opt);
+    double* mss = LB_SS(opt);
+    double* wn1 = LB_SND(opt);
+
+    if (strncmp(opt->task, "FG_START", 8) != 0)
+        return -1;
+    if (k <= 0)
+        return 0;
+
+    /* select the most recent pairs satisfying the curvature condition */
+    keep = (int*) malloc(sizeof(int)*m);
+    if (!keep)
+        return -1;
+    col = 0;
+    for (i = k - 1; i >= 0 && col < m; --i) {
+        sy = dot(n, s + i*n, y + i*n);
+        yy = dot(n, y + i*n, y + i*n);
+        if (sy > DBL_EPSILON*yy)
+            keep[col++] = i;
+    }
+    if (col == 0) {
+        free(keep);
+        return 0;
+    }
+
+    /* ws/wy columns 1..col, oldest first (head = 1) */
+    for (j = 0; j < col; ++j) {
+        first = keep[col - 1 - j];
+        memcpy(ws + j*n, s + first*n, n*sizeof(double));
+        memcpy(wy + j*n, y + first*n, n*sizeof(double));
+    }
+    free(keep);
+
+    /* sy(i,j) = s_i.y_j (i >= j), ss(i,j) = s_i.s_j (i <= j), see matupd */
+    for (i = 0; i < col; ++i)
+        for (j = 0; j < col; ++j) {
+            msy[i + j*m] = (i >= j) ? dot(n, ws + i*n, wy + j*n) : 0.0;
+            mss[i + j*m] = (i <= j) ? dot(n, ws + i*n, ws + j*n) : 0.0;
+        }
+
+    /* wn1 as left by formk when all the variables are free, see formk */
+    for (i = 0; i < m2*m2; ++i)
+        wn1[i] = 0.0;
+    for (i = 0; i < col; ++i)
+        for (j = 0; j < col; ++j) {
+            if (i >= j)
+                wn1[i + j*m2] = dot(n, wy + i*n, wy + j*n);
+            if (i <= j)
+                wn1[(m + i) + j*m2] = dot(n, ws + i*n, wy + j*n);
+        }
+
+    opt->dsave[0] = dot(n, wy + (col-1)*n, wy + (col-1)*n)
+                    / dot(n, ws + (col-1)*n, wy + (col-1)*n); /* theta */
+
+    formt_(&opt->m, LB_WT(opt), msy, mss, &col, &opt->dsave[0], &info);
+    if (info != 0) {
+        opt->isave[LB_COL] = 0;
+        opt->isave[LB_HEAD] = 1;
+        opt->isave[LB_IUPDAT] = 0;
+        opt->dsave[0] = 1.0;
+        return -1;
+    }
+
+    opt->isave[LB_HEAD] = 1;
+    opt->isave[LB_COL] = col;
+    opt->isave[LB_ITAIL] = col;
+    opt->isave[LB_IUPDAT] = col;
+    /* not the first iteration anymore: full step in the line search, and
+     * the free variables are compared to the full set (index below) */
+    opt->isave[LB_ITER] = 1;
+    opt->isave[LB_NFREE] = n;
+    opt->isave[LB_ILEAVE] = n + 1; /* no variable left or entered the free set */
+    opt->isave[LB_NENTER] = 0;
+    for (i = 0; i < n; ++i)
+        opt->iwa[i] = i + 1;
+    opt->lsave[3] = 1; /* updatd */
+
+    return col;
+}
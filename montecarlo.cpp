@@ -0,0 +1,364 @@
+
+#include "montecarlo.h"
+#include "geometry.h"
+
+#include <cassert>
+#include <cstring> //memcpy
+#include <stdexcept>
+#include <sys/time.h> //gettimeofday
+
+
+
+namespace PTools
+{
+
+
+// xorshift64* generator: one state per chain, thus thread-safe and
+// reproducible whatever the number of threads (unlike rand())
+static inline double uniform(unsigned long long& state)
+{
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    unsigned long long r = state * 2685821657736338717ULL;
+    return (r >> 11) * (1.0/9007199254740992.0); // [0,1[
+}
+
+
+static double wallclock()
+{
+    timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + 1e-6*tv.tv_usec;
+}
+
+
+static void matrixToMat44(const Matrix& in, dbl out[4][4])
+{
+    for (uint i=0; i<4; i++)
+        for (uint j=0; j<4; j++)
+            out[i][j] = in(i,j);
+}
+
+
+/// rotation of angle theta around the (unit) axis passing through center (Rodrigues formula)
+static void axisRotation(const Coord3D& axis, const Coord3D& center, dbl theta, dbl out[4][4])
+{
+    dbl c = cos(theta);
+    dbl s = sin(theta);
+    dbl t = 1.0 - c;
+    dbl x = axis.x, y = axis.y, z = axis.z;
+
+    out[0][0] = t*x*x + c;   out[0][1] = t*x*y - s*z; out[0][2] = t*x*z + s*y;
+    out[1][0] = t*x*y + s*z; out[1][1] = t*y*y + c;   out[1][2] = t*y*z - s*x;
+    out[2][0] = t*x*z - s*y; out[2][1] = t*y*z + s*x; out[2][2] = t*z*z + c;
+
+    // center is a fixed point: translation = center - R.center
+    out[0][3] = center.x - (out[0][0]*center.x + out[0][1]*center.y + out[0][2]*center.z);
+    out[1][3] = center.y - (out[1][0]*center.x + out[1][1]*center.y + out[1][2]*center.z);
+    out[2][3] = center.z - (out[2][0]*center.x + out[2][1]*center.y + out[2][2]*center.z);
+
+    out[3][0] = 0.0; out[3][1] = 0.0; out[3][2] = 0.0; out[3][3] = 1.0;
+}
+
+
+
+MonteCarlo::MonteCarlo(const BaseAttractForceField& ff, const AttractRigidbody& receptor, dbl cutoff, dbl skin)
+        :_ff(ff), _receptor(receptor), _cutoff(cutoff), _skin(skin)
+{
+    _tstart = 1.0;
+    _tend = 1.0;
+    _trans = 0.5;
+    _rot = 0.05;
+    _target = 0.4;
+    _interval = 100;
+    _seed = 1;
+    _movespersec = 0.0;
+    _seconds = 0.0;
+}
+
+
+uint MonteCarlo::AddChain(const AttractRigidbody& lig)
+{
+    _ff.CheckDesolvationTypes(_receptor);
+    _ff.CheckDesolvationTypes(lig);
+
+    Chain chain;
+    chain.ligand = lig;
+
+    //initial coordinates of the ligand are the reference coordinates + the ligand matrix
+    matrixToMat44(chain.ligand.GetMatrix(), chain.initial);
+    chain.ligand.ResetMatrix();
+    chain.center = chain.ligand.FindCenter();
+
+    for (uint i=0; i<4; i++)
+        for (uint j=0; j<4; j++)
+        {
+            chain.current[i][j] = chain.initial[i][j];
+            chain.best[i][j] = chain.initial[i][j];
+        }
+
+    chain.energy = 0.0;
+    chain.bestenergy = 0.0;
+    chain.step[0] = _trans;
+    chain.step[1] = _rot;
+    for (uint k=0; k<2; k++)
+    {
+        chain.trials[k] = 0;
+        chain.accepted[k] = 0;
+        chain.windowtrials[k] = 0;
+        chain.windowaccepted[k] = 0;
+    }
+    chain.rebuilds = 0;
+    chain.random = 0;
+
+    _chains.push_back(chain);
+
+    Chain& added = _chains.back();
+    setPose(added, added.current);
+    AttractPairList pl(_receptor, added.ligand, _cutoff);
+    added.energy = _ff.nonbon8_energy(_receptor, added.ligand, pl);
+    added.bestenergy = added.energy;
+
+    return _chains.size()-1;
+}
+
+
+void MonteCarlo::SetTemperature(dbl tstart, dbl tend)
+{
+    if (tstart <= 0.0 || tend <= 0.0)
+        throw std::invalid_argument("MonteCarlo::SetTemperature: temperatures must be positive");
+    _tstart = tstart;
+    _tend = tend;
+}
+
+
+void MonteCarlo::SetStepSizes(dbl trans, dbl rot)
+{
+    _trans = trans;
+    _rot = rot;
+    for (uint i=0; i<_chains.size(); i++)
+    {
+        _chains[i].step[0] = trans;
+        _chains[i].step[1] = rot;
+    }
+}
+
+
+void MonteCarlo::SetAdaptation(dbl target, uint interval)
+{
+    _target = target;
+    _interval = interval;
+}
+
+
+dbl MonteCarlo::temperature(uint move, uint nmoves) const
+{
+    if (nmoves < 2) return _tstart;
+    return _tstart * pow(_tend/_tstart, (dbl) move / (dbl) (nmoves-1));
+}
+
+
+void MonteCarlo::setPose(Chain& chain, const dbl mat[4][4])
+{
+    // the ligand keeps its initial coordinates: only its 4x4 matrix is modified
+    chain.ligand.ResetMatrix();
+    Matrix m(4,4);
+    for (uint i=0; i<4; i++)
+        for (uint j=0; j<4; j++)
+            m(i,j) = mat[i][j];
+    chain.ligand.ApplyMatrix(m);
+}
+
+
+void MonteCarlo::runChain(Chain& chain, uint nmoves)
+{
+    Matrix pose(4,4); //allocated once, reused for every trial
+    dbl trial[4][4];
+    dbl move[4][4];
+
+    for (uint k=0; k<2; k++)
+    {
+        chain.trials[k] = 0;
+        chain.accepted[k] = 0;
+        chain.windowtrials[k] = 0;
+        chain.windowaccepted[k] = 0;
+    }
+    chain.rebuilds = 0;
+
+    for (uint imove=0; imove<nmoves; imove++)
+    {
+        dbl kT = temperature(imove, nmoves);
+
+        Coord3D center;
+        mat44xVect(chain.current, chain.center, center);
+
+        uint type = (uniform(chain.random) < 0.5) ? 0 : 1;
+        if (type == 0)
+        {
+            //random translation in a cube of side 2*step
+            MakeTranslationMat44(Coord3D( (2.0*uniform(chain.random)-1.0) * chain.step[0],
+                                          (2.0*uniform(chain.random)-1.0) * chain.step[0],
+                                          (2.0*uniform(chain.random)-1.0) * chain.step[0]), move);
+        }
+        else
+        {
+            //random rotation around the ligand center (uniform axis)
+            dbl cz = 2.0*uniform(chain.random)-1.0;
+            dbl phi = 2.0*M_PI*uniform(chain.random);
+            dbl sz = sqrt(1.0-cz*cz);
+            Coord3D axis(sz*cos(phi), sz*sin(phi), cz);
+            axisRotation(axis, center, (2.0*uniform(chain.random)-1.0) * chain.step[1], move);
+        }
+
+        mat44xmat44(move, chain.current, trial);
+
+        chain.ligand.ResetMatrix();
+        for (uint i=0; i<4; i++)
+            for (uint j=0; j<4; j++)
+                pose(i,j) = trial[i][j];
+        chain.ligand.ApplyMatrix(pose);
+
+        if (chain.pairlist.updateIfNeeded()) chain.rebuilds++;
+
+        dbl e = _ff.nonbon8_energy(_receptor, chain.ligand, chain.pairlist);
+        dbl de = e - chain.energy;
+
+        chain.trials[type]++;
+        chain.windowtrials[type]++;
+
+        if (de <= 0.0 || uniform(chain.random) < exp(-de/kT))
+        {
+            chain.accepted[type]++;
+            chain.windowaccepted[type]++;
+            chain.energy = e;
+            memcpy(chain.current, trial, 16*sizeof(dbl));
+
+            if (e < chain.bestenergy)
+            {
+                chain.bestenergy = e;
+                memcpy(chain.best, trial, 16*sizeof(dbl));
+            }
+        }
+
+        //adaptive step size
+        if (_interval > 0 && chain.windowtrials[type] == _interval)
+        {
+            dbl rate = (dbl) chain.windowaccepted[type] / (dbl) _interval;
+            if (rate > _target) chain.step[type] *= 1.1;
+            else chain.step[type] /= 1.1;
+
+            if (type == 1 && chain.step[1] > M_PI) chain.step[1] = M_PI;
+            chain.windowtrials[type] = 0;
+            chain.windowaccepted[type] = 0;
+        }
+    }
+
+}
+
+
+void MonteCarlo::Run(uint nmoves)
+{
+    //the receptor is never moved: synchronizing its coordinates once
+    //makes it read-only for all the threads
+    _receptor.syncCoords();
+
+    //exceptions cannot leave the parallel region: the forcefield is checked here
+    _ff.CheckDesolvationTypes(_receptor);
+
+    for (uint i=0; i<_chains.size(); i++)
+    {
+        Chain& chain = _chains[i];
+        _ff.CheckDesolvationTypes(chain.ligand);
+        setPose(chain, chain.current);
+        chain.pairlist = AttractPairList(_receptor, chain.ligand, _cutoff, _skin);
+        chain.energy = _ff.nonbon8_energy(_receptor, chain.ligand, chain.pairlist);
+        //one seed per chain: results do not depend on the number of threads
+        chain.random = 0x9E3779B97F4A7C15ULL * (unsigned long long) (_seed + 1) + 0xD1B54A32D192ED03ULL * (unsigned long long) (i + 1);
+    }
+
+    dbl start = wallclock();
+
+    int nchains = _chains.size();
+    #pragma omp parallel for schedule(dynamic,1)
+    for (int i=0; i<nchains; i++)
+    {
+        runChain(_chains[i], nmoves);
+    }
+
+    _seconds = wallclock() - start;
+    dbl total = (dbl) nmoves * (dbl) _chains.size();
+    _movespersec = (_seconds > 0.0) ? total/_seconds : 0.0;
+}
+
+
+AttractRigidbody MonteCarlo::GetLigand(uint i)
+{
+    if (i >= _chains.size()) throw std::out_of_range("MonteCarlo::GetLigand: chain index out of range");
+    AttractRigidbody lig(_chains[i].ligand);
+    lig.ResetMatrix();
+    lig.ApplyMatrix(GetMatrix(i));
+    return lig;
+}
+
+
+dbl MonteCarlo::GetEnergy(uint i) const
+{
+    if (i >= _chains.size()) throw std::out_of_range("MonteCarlo::GetEnergy: chain index out of range");
+    return _chains[i].bestenergy;
+}
+
+
+Matrix MonteCarlo::GetMatrix(uint i) const
+{
+    if (i >= _chains.size()) throw std::out_of_range("MonteCarlo::GetMatrix: chain index out of range");
+    Matrix out(4,4);
+    for (uint k=0; k<4; k++)
+        for (uint l=0; l<4; l++)
+            out(k,l) = _chains[i].best[k][l];
+    return out;
+}
+
+
+dbl MonteCarlo::GetAcceptanceRate(uint i) const
+{
+    if (i >= _chains.size()) throw std::out_of_range("MonteCarlo::GetAcceptanceRate: chain index out of range");
+    const Chain& chain = _chains[i];
+    uint trials = chain.trials[0] + chain.trials[1];
+    if (trials == 0) return 0.0;
+    return (dbl) (chain.accepted[0] + chain.accepted[1]) / (dbl) trials;
+}
+
+
+dbl MonteCarlo::GetAcceptanceRate() const
+{
+    dbl trials = 0.0;
+    dbl accepted = 0.0;
+    for (uint i=0; i<_chains.size(); i++)
+    {
+        trials += _chains[i].trials[0] + _chains[i].trials[1];
+        accepted += _chains[i].accepted[0] + _chains[i].accepted[1];
+    }
+    if (trials == 0.0) return 0.0;
+    return accepted/trials;
+}
+
+
+void MonteCarlo::PrintStats() const
+{
+    for (uint i=0; i<_chains.size(); i++)
+    {
+        const Chain& chain = _chains[i];
+        dbl acct = chain.trials[0] ? (dbl) chain.accepted[0]/chain.trials[0] : 0.0;
+        dbl accr = chain.trials[1] ? (dbl) chain.accepted[1]/chain.trials[1] : 0.0;
+        std::cout << "chain " << i << "  best energy: " << chain.bestenergy
+                  << "  acceptance (trans/rot): " << acct << " / " << accr
+                  << "  steps: " << chain.step[0] << " A / " << chain.step[1] << " rad"
+                  << "  pairlist updates: " << chain.rebuilds << std::endl;
+    }
+    std::cout << _chains.size() << " chains, acceptance rate: " << GetAcceptanceRate()
+              << ", " << _seconds << " s, " << _movespersec << " moves/s" << std::endl;
+}
+
+
+} // namespace PTools
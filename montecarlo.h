@@ -0,0 +1,120 @@
+//  Monte Carlo / simulated annealing refinement
+//
+//
+
+
+
+#ifndef _MONTECARLO_H_
+#define _MONTECARLO_H_
+
+#include "attractforcefield.h"
+#include "pairlist.h"
+
+
+namespace PTools{
+
+
+/*! \brief Metropolis Monte Carlo with rigid-body moves
+*
+*   Refinement stage after the Lbfgs minimization: each chain moves one copy of
+*   the ligand around the (fixed) receptor with random translations and random
+*   rotations around the ligand center. Step sizes are adapted to reach a target
+*   acceptance rate and the temperature (kT, in energy units) follows a geometric
+*   schedule from tstart to tend (simulated annealing if tend < tstart).
+*
+*   Trial moves only change the 4x4 matrix of the ligand and are evaluated with
+*   BaseAttractForceField::nonbon8_energy() on a pairlist with a skin, so that a
+*   rejected move costs one energy evaluation and no allocation.
+*   Chains are independent and run in parallel (OpenMP).
+*/
+class MonteCarlo
+{
+
+public:
+
+    MonteCarlo(const BaseAttractForceField& ff, const AttractRigidbody& receptor, dbl cutoff, dbl skin=2.0);
+
+    ///add a new chain starting from the current position of lig. Returns the chain index
+    uint AddChain(const AttractRigidbody& lig);
+
+    ///temperatures (kT, same units as the energy) at the first and at the last move of Run()
+    void SetTemperature(dbl tstart, dbl tend);
+
+    ///initial step sizes: maximal translation (Angstrom) and rotation angle (radians)
+    void SetStepSizes(dbl trans, dbl rot);
+
+    ///step sizes are adapted every 'interval' trials of a given move type to reach 'target' acceptance
+    void SetAdaptation(dbl target, uint interval);
+
+    void SetSeed(uint seed){_seed = seed;};
+
+    ///performs nmoves trial moves for every chain
+    void Run(uint nmoves);
+
+    uint NbChains() const {return _chains.size();};
+
+    ///lowest energy pose found by chain i
+    AttractRigidbody GetLigand(uint i);
+    ///energy of GetLigand(i)
+    dbl GetEnergy(uint i) const;
+    ///4x4 matrix of GetLigand(i): absolute matrix applied to the reference coordinates of the ligand given to AddChain
+    Matrix GetMatrix(uint i) const;
+
+    dbl GetAcceptanceRate(uint i) const; ///< acceptance rate of chain i during the last Run()
+    dbl GetAcceptanceRate() const; ///< acceptance rate over all chains during the last Run()
+    dbl GetMovesPerSecond() const {return _movespersec;}; ///< throughput of the last Run()
+
+    void PrintStats() const;
+
+
+private:
+
+    struct Chain
+    {
+        AttractRigidbody ligand;
+        AttractPairList pairlist;
+
+        dbl initial[4][4]; ///< matrix of the ligand given to AddChain
+        dbl current[4][4]; ///< current pose (absolute matrix applied to the initial coordinates)
+        dbl best[4][4];
+        Coord3D center; ///< center of the initial coordinates
+
+        dbl energy;
+        dbl bestenergy;
+
+        dbl step[2]; ///< translation (0) and rotation (1) step sizes
+        uint trials[2];
+        uint accepted[2];
+        uint windowtrials[2];
+        uint windowaccepted[2];
+        uint rebuilds; ///< number of pairlist updates
+
+        unsigned long long random; ///< state of the random generator of the chain
+    };
+
+    void setPose(Chain& chain, const dbl mat[4][4]);
+    void runChain(Chain& chain, uint nmoves);
+    dbl temperature(uint move, uint nmoves) const;
+
+    const BaseAttractForceField& _ff;
+    AttractRigidbody _receptor;
+    dbl _cutoff;
+    dbl _skin;
+
+    dbl _tstart, _tend;
+    dbl _trans, _rot;
+    dbl _target;
+    uint _interval;
+    uint _seed;
+
+    std::vector<Chain> _chains;
+
+    dbl _movespersec;
+    dbl _seconds;
+
+};
+
+
+}//namespace PTools
+
+#endif // _MONTECARLO_H_
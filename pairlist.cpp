@@ -1,5 +1,7 @@
 #include "pairlist.h"
 
+#include <cfloat> //for DBL_MAX
+
 namespace PTools
 {
 
@@ -9,11 +11,22 @@ AttractPairList::AttractPairList(const AttractRigidbody & receptor , const Attra
     mp_ligand = &ligand;
     mp_receptor = &receptor;
     squarecutoff = cutoff*cutoff;
+    m_skin = 0.0;
     no_update = false;
     update();
 }
 
 
+AttractPairList::AttractPairList(const AttractRigidbody & receptor, const AttractRigidbody & ligand, dbl cutoff, dbl skin )
+{
+    mp_ligand = &ligand;
+    mp_receptor = &receptor;
+    squarecutoff = cutoff*cutoff;
+    m_skin = skin;
+    no_update = false;
+    update();
+}
+
 
 
 AttractPairList::AttractPairList(const AttractRigidbody & receptor, const AttractRigidbody & ligand)
@@ -22,6 +35,8 @@ AttractPairList::AttractPairList(const AttractRigidbody & receptor, const Attrac
     mp_ligand = &ligand;
     mp_receptor = &receptor;
     no_update = true ; //if infinite cutoff
+    squarecutoff = DBL_MAX;
+    m_skin = 0.0;
 
     for (uint i = 0 ; i < mp_ligand->Size(); i++)
         for (uint j = 0; j < mp_receptor->Size(); j++)
@@ -73,6 +88,10 @@ void AttractPairList::update()
     uint activeligsize = activelig.size();
     uint activerecsize = activerec.size();
 
+    //pairs are collected up to cutoff+skin:
+    dbl listcutoff = sqrt(squarecutoff) + m_skin;
+    dbl squarelistcutoff = listcutoff*listcutoff;
+
 
     for (uint ii = 0 ; ii < activeligsize ; ii++)
     {
@@ -85,7 +104,7 @@ void AttractPairList::update()
 
             Coord3D c1 = mp_ligand->GetCoords(i) ;
             Coord3D c2 = mp_receptor->GetCoords(j);
-            if (Norm2(c1-c2) <= squarecutoff)
+            if (Norm2(c1-c2) <= squarelistcutoff)
             {
                 vectl.push_back(i);
                 vectr.push_back(j);
@@ -95,7 +114,44 @@ void AttractPairList::update()
         }
     }
 
+    //save current positions for needsUpdate() (only useful with a skin).
+    //assign() reuses the storage once the ligand size is known:
+    if (m_skin > 0.0)
+    {
+        const Coord3D* ligcoords = mp_ligand->GetMovedCoords();
+        m_ligref.assign(ligcoords, ligcoords + mp_ligand->Size());
+        mp_receptor->CopyMatrix(m_recmatrix);
+    }
+
+}
+
 
+bool AttractPairList::needsUpdate() const
+{
+    if (no_update) return false;
+    if (m_skin <= 0.0) return true;
+
+    if (m_ligref.size() != mp_ligand->Size())
+        return true;
+
+    //called for every Monte Carlo trial: keep this test free of allocations
+    //(stack copy of the matrix, no Matrix/Rigidbody temporaries)
+
+    //the receptor is usually fixed: any change of its matrix invalidates the list
+    dbl recmatrix[4][4];
+    mp_receptor->CopyMatrix(recmatrix);
+    for (uint i=0; i<4; i++)
+        for (uint j=0; j<4; j++)
+            if (recmatrix[i][j] != m_recmatrix[i][j]) return true;
+
+    //a pair further than cutoff+skin at the last update can only come within
+    //the cutoff if the ligand atom moved by more than 'skin'
+    const Coord3D* ligcoords = mp_ligand->GetMovedCoords();
+    dbl skin2 = m_skin*m_skin;
+    for (uint i=0; i<m_ligref.size(); i++)
+        if (Norm2(ligcoords[i] - m_ligref[i]) > skin2) return true;
+
+    return false;
 }
 
 
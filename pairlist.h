@@ -29,6 +29,7 @@ class AttractPairList
 public:
     AttractPairList(const AttractRigidbody & receptor, const AttractRigidbody & ligand, dbl cutoff );
     AttractPairList(const AttractRigidbody & receptor,const AttractRigidbody &  ligand); ///< constructor with infinite cutoff ;
+    AttractPairList(const AttractRigidbody & receptor, const AttractRigidbody & ligand, dbl cutoff, dbl skin ); ///< pairlist with a skin (see needsUpdate())
     AttractPairList(){}; //null constructor for use with std::vector
 
     ~AttractPairList();
@@ -36,6 +37,22 @@ public:
     ///update pairlist
     void update();
 
+    /*! \brief true if the pairlist may miss some pairs within the cutoff
+    *
+    *   pairs are collected up to cutoff+skin: the list remains valid as long as no
+    *   ligand atom moved by more than the skin since the last update() and the
+    *   matrix of the receptor did not change (the receptor atoms are not compared,
+    *   call update() after editing them). Without skin, always true.
+    */
+    bool needsUpdate() const;
+
+    ///calls update() only if needsUpdate() is true. Returns true if the list was rebuilt
+    bool updateIfNeeded() {
+        if (no_update || !needsUpdate()) return false;
+        update();
+        return true;
+    };
+
     ///< Add a pair and checks if correct ligand and receptor are provided
     void addPair(const AttractRigidbody& ligand, const AttractRigidbody& receptor, const AtomPair& pair) ;
 
@@ -44,11 +61,25 @@ public:
         return sqrt(squarecutoff);
     };
 
+    ///return cutoff^2 (pairs are stored up to (cutoff+skin)^2)
+    dbl GetSquareCutoff() const {
+        return squarecutoff;
+    };
+
+    ///return the skin added to the cutoff when the list is built
+    dbl GetSkin() const {
+        return m_skin;
+    };
+
     ///return number of pairs of atoms in interaction (distance <= cutoff)
     uint Size() {
         return vectl.size();
     };
 
+    ///ligand and receptor atoms of the pairs, as arrays (see BaseAttractForceField::nonbon8_pairs)
+    const uint* LigandAtoms() const {return vectl.empty() ? 0 : &vectl[0];};
+    const uint* ReceptorAtoms() const {return vectr.empty() ? 0 : &vectr[0];};
+
     /// get atom pair number i of the pairlist
     AtomPair operator[](int i) {
         AtomPair pair;
@@ -61,6 +92,7 @@ public:
 private:
 
     dbl squarecutoff ; ///< cutoff^2
+    dbl m_skin ; ///< pairs are collected up to cutoff+skin
     const AttractRigidbody* mp_ligand;
     const AttractRigidbody* mp_receptor;
 
@@ -69,6 +101,9 @@ private:
     std::vector <uint> vectl ; ///< index of ligands atoms
     std::vector <uint> vectr ; ///< index of receptor atoms
 
+    std::vector <Coord3D> m_ligref ; ///< ligand coordinates at the last update (for needsUpdate, with a skin)
+    dbl m_recmatrix[4][4] ; ///< receptor matrix at the last update (with a skin)
+
 };
 
 
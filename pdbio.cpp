@@ -1,8 +1,16 @@
 #include <algorithm>
 #include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "atom.h"
 #include "stdio.h"
 #include "pdbio.h"
@@ -20,170 +28,411 @@ std::string strip( std::string const& str, char const* sepSet ) {
 }
 
 
-bool isAtom(const std::string & line ) {
-    //cout << ligne.size()<< endl ;
-    if (line.size()<10 ) return false;
-
-    if (line.substr(0,6)==(std::string) "ATOM  " ) return true ;
-    return false;
-}
+/// one line of a PDB file, [begin, end) without the end of line
+struct PdbLine
+{
+    const char* begin;
+    const char* end;
 
+    uint size() const {return end - begin;};
+    /// field of a fixed column range, clipped to the line
+    void field(uint start, uint length, const char*& fb, const char*& fe) const
+    {
+        uint n = size();
+        fb = begin + std::min(start, n);
+        fe = begin + std::min(start + length, n);
+    }
+};
 
-bool isHeteroAtom(const std::string& line) {
-    if (line.size()<10) return false;
 
-    if (line.substr(0,6) == "HETATM") return true;
-    return false;
+static bool isAtom(const PdbLine& line) {
+    return line.size() >= 10 && memcmp(line.begin, "ATOM  ", 6) == 0;
 }
 
 
+/// integer of a fixed column field, like atoi()
+static int parseInt(const char* p, const char* end)
+{
+    while (p < end && *p == ' ') p++;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+    int value = 0;
+    while (p < end && *p >= '0' && *p <= '9') value = 10*value + (*p++ - '0');
+    return negative ? -value : value;
+}
 
 
-std::string readatomtype(const std::string &ligne) {
-    std::string type="" ;
-    int i=12 ;
-    while (ligne[i]==' ')
+/// real number of a fixed column field, like atof()
+static dbl parseReal(const char* p, const char* end)
+{
+    const char* start = p;
+    while (p < end && *p == ' ') p++;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+
+    //the mantissa is an exact integer up to 15 digits, divided once by an exact power of ten
+    static const dbl pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+    long long mantissa = 0;
+    int digits = 0, decimals = 0;
+    while (p < end && *p >= '0' && *p <= '9') {mantissa = 10*mantissa + (*p++ - '0'); digits++;}
+    if (p < end && *p == '.')
     {
-        i++;
-        if (i>15) return type ;
+        p++;
+        while (p < end && *p >= '0' && *p <= '9') {mantissa = 10*mantissa + (*p++ - '0'); digits++; decimals++;}
     }
 
-    int j=i ;
-    while (ligne[j]!=' ') j++ ;
+    if (digits > 15 || (p < end && *p != ' '))
+    {
+        //rare formats (exponent, nan, overflowing fields...): standard conversion
+        char buffer[64];
+        uint n = std::min<size_t>(end - start, sizeof(buffer) - 1);
+        memcpy(buffer, start, n);
+        buffer[n] = '\0';
+        return atof(buffer);
+    }
 
-    type=ligne.substr(i,j-i) ;
-    std::transform(type.begin(),type.end(),
-                   type.begin(), //destination
-                   (int(*)(int)) toupper //to upper: convert to upper case
-                  );
+    dbl value = (dbl) mantissa / pow10[decimals];
+    return negative ? -value : value;
+}
 
-    //cout << type <<"a" ;
 
+static bool isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
 
 
-    return type;
+/*! \brief Attract category and charge at the beginning of an extra field
+*
+*   only plain "category charge" fields are accepted (no exponent, no sign for
+*   the category): they give the same values as reading the field with a stream.
+*   Other fields return false and are left to AttractRigidbody.
+*/
+static bool parseAttractFields(const char* p, const char* end, uint& category, dbl& charge)
+{
+    while (p < end && isBlank(*p)) p++;
+    const char* q = p;
+    uint value = 0;
+    while (q < end && *q >= '0' && *q <= '9') value = 10*value + (*q++ - '0');
+    if (q == p || q - p > 9 || q == end || !isBlank(*q)) return false;
+
+    p = q;
+    while (p < end && isBlank(*p)) p++;
+    q = p;
+    if (q < end && (*q == '-' || *q == '+')) q++;
+    const char* digits = q;
+    while (q < end && ((*q >= '0' && *q <= '9') || *q == '.')) q++;
+    if (q == digits || (q == digits + 1 && *digits == '.') || std::count(digits, q, '.') > 1) return false;
+    if (q < end && !isBlank(*q)) return false;
+
+    category = value;
+    charge = parseReal(p, q);
+    return true;
 }
 
 
-std::string readresidtype(const std::string &ligne) {
-    std::string type="" ;
-    int i=17 ;
-    while (ligne[i]==' ')
+/// first word of a field (the word may extend after the field), upper case
+static std::string readWord(const PdbLine& line, uint start, uint last)
+{
+    const char* p = line.begin + start;
+    const char* fieldend = line.begin + last + 1;
+    while (p < line.end && *p == ' ')
     {
-        i++;
-        if (i>19) return type ;
+        p++;
+        if (p >= fieldend) return std::string();
     }
+    const char* q = p;
+    while (q < line.end && *q != ' ') q++;
 
-    int j=i ;
-    while (ligne[j]!=' ') j++ ;
+    std::string word(p, q);
+    std::transform(word.begin(), word.end(), word.begin(), (int(*)(int)) toupper);
+    return word;
+}
 
-    type=ligne.substr(i,j-i) ;
-    std::transform(type.begin(),type.end(),
-                   type.begin(), //destination
-                   (int(*)(int)) toupper //to upper: convert to upper case
-                  );
 
-    //cout << type <<"a" ;
+/// next line of a buffer, returns false at the end of the buffer
+static bool nextLine(const char*& p, const char* end, PdbLine& line)
+{
+    if (p >= end) return false;
+    const char* eol = (const char*) memchr(p, '\n', end - p);
+    line.begin = p;
+    line.end = eol ? eol : end;
+    p = eol ? eol + 1 : end;
+    return true;
+}
+
 
+/*! \brief reads the ATOM records of a PDB file loaded in memory
+*
+*   the records are counted first to reserve the rigidbody, then fields are
+*   parsed in place at their fixed columns (no temporary string per field).
+*   With attractfields, the Attract category and charge of the extra field are
+*   also stored in the atom properties.
+*/
+static void readPDBBuffer(const char* buffer, size_t size, Rigidbody& protein, bool attractfields)
+{
+    const char* end = buffer + size;
+    PdbLine line;
 
+    uint natoms = 0;
+    for (const char* p = buffer; nextLine(p, end, line); )
+        if (isAtom(line)) natoms++;
+    protein.Reserve(protein.Size() + natoms);
 
-    return type;
+    Atomproperty a;
+    const char *fb, *fe;
+    for (const char* p = buffer; nextLine(p, end, line); )
+    {
+        if (!isAtom(line)) continue;
+
+        Coord3D pos;
+        line.field(30, 8, fb, fe);
+        pos.x = parseReal(fb, fe);
+        line.field(38, 8, fb, fe);
+        pos.y = parseReal(fb, fe);
+        line.field(46, 8, fb, fe);
+        pos.z = parseReal(fb, fe);
+
+        a.SetType(readWord(line, 12, 15));
+        a.SetResidType(readWord(line, 17, 19));
+        line.field(21, 1, fb, fe);
+        a.SetChainId(std::string(fb, fe));
+        line.field(22, 4, fb, fe);
+        a.SetResidId(parseInt(fb, fe));
+        line.field(6, 5, fb, fe);
+        a.SetAtomId(parseInt(fb, fe));
+        line.field(54, line.size(), fb, fe); //everything after the coordinates
+        a.SetExtra(std::string(fb, fe));
+        uint category;
+        dbl charge;
+        if (attractfields && parseAttractFields(fb, fe, category, charge))
+            a.SetAttractFields(category, charge);
+
+        protein.AddAtom(a, pos);
+    }
 }
 
 
-void ReadPDB(ifstream& fichier, Rigidbody& protein) {
+void ReadPDB(ifstream& fichier, Rigidbody& protein, bool attractfields) {
+
+    std::ostringstream content;
+    content << fichier.rdbuf();
+    std::string buffer = content.str();
+    readPDBBuffer(buffer.data(), buffer.size(), protein, attractfields);
+}
 
-    std::string ligne ;
-    int compteur = 0 , compteur1=0;
-    //std::cout << "file opening  " << nomfich.c_str() << std::endl ;
 
 
-    while ( std::getline(fichier, ligne))
+void ReadPDB(const std::string name,Rigidbody& protein, bool attractfields) {
+    std::string nomfich=name ;
+    int fd = open(nomfich.c_str(), O_RDONLY);
+    if (fd < 0)
     {
-        compteur++ ;
-        if (isAtom(ligne))
-        {
-            // cout <<ligne <<endl;
-            compteur1++ ;
+        throw std::invalid_argument("##### ReadPDB:Could not open file \"" + nomfich + "\" #####") ;
+    }
 
-            std::string sx,sy,sz;
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
 
-            sx=ligne.substr(30,8);
-            sy=ligne.substr(38,8);
-            sz=ligne.substr(46,8);
+    if (map != MAP_FAILED)
+    {
+        readPDBBuffer((const char*) map, st.st_size, protein, attractfields);
+        munmap(map, st.st_size);
+        close(fd);
+        return;
+    }
+
+    //empty file or no mmap support (pipes...)
+    close(fd);
+    ifstream fichier(nomfich.c_str());
+    ReadPDB(fichier, protein, attractfields);
+    fichier.close();
+    return;
 
-            Coord3D pos;
-            pos.x=atof(sx.c_str());
-            pos.y=atof(sy.c_str());
-            pos.z=atof(sz.c_str());
+}
 
-            Atomproperty a;
-            a.SetType( readatomtype(ligne));
-            a.SetResidType(readresidtype(ligne));
-            a.SetChainId(ligne.substr(21,1));
-            a.SetResidId(atoi(ligne.substr(22,4).c_str()));
-            a.SetAtomId(atoi(ligne.substr(6,5).c_str()));
-            std::string extra = ligne.substr(54,ligne.size()-1-54+1); //extracts everything after the position 27 to the end of line
-            a.SetExtra(extra);
+/// appends an integer right aligned in a field of 'width' characters, like %<width>d
+static void appendInt(std::string& out, int value, uint width)
+{
+    char buffer[16];
+    char* end = buffer + sizeof(buffer);
+    char* p = end;
+    unsigned int v = value < 0 ? 0u - (unsigned int) value : (unsigned int) value;
+    do {*--p = '0' + v % 10; v /= 10;} while (v);
+    if (value < 0) *--p = '-';
+    for (uint n = end - p; n < width; n++) out += ' ';
+    out.append(p, end);
+}
 
-            protein.AddAtom(a,pos);
 
-        }
+/// appends a string in a field of 'width' characters, like %<width>s or %-<width>s
+static void appendString(std::string& out, const std::string& s, uint width, bool left)
+{
+    if (!left) for (uint n = s.size(); n < width; n++) out += ' ';
+    out += s;
+    if (left) for (uint n = s.size(); n < width; n++) out += ' ';
+}
 
 
+/*! \brief appends a real number like %8.3f
+*
+*   the value is rounded as an integer number of thousandths. Values close to
+*   half a thousandth, large values and negative values rounded to zero are
+*   left to snprintf, so that the output is always the one of %8.3f.
+*/
+static void appendFixed(std::string& out, double x)
+{
+    char buffer[32];
+    double t = x * 1000.0;
+    double r = floor(t + 0.5);
+    if (!(fabs(t) < 1e9) || fabs(fabs(t - floor(t)) - 0.5) < 1e-6 || (r == 0.0 && x <= 0.0))
+    {
+        int n = snprintf(buffer, sizeof(buffer), "%8.3f", x);
+        if (n < (int) sizeof(buffer))
+        {
+            out.append(buffer, n);
+            return;
+        }
+        //huge values (up to ~310 characters)
+        std::vector<char> large(n + 1);
+        snprintf(&large[0], large.size(), "%8.3f", x);
+        out.append(&large[0], n);
+        return;
     }
 
+    char* end = buffer + sizeof(buffer);
+    char* p = end;
+    long long v = (long long) fabs(r);
+    for (int d=0; d<3; d++) {*--p = '0' + v % 10; v /= 10;}
+    *--p = '.';
+    do {*--p = '0' + v % 10; v /= 10;} while (v);
+    if (r < 0) *--p = '-';
+    for (uint n = end - p; n < 8; n++) out += ' ';
+    out.append(p, end);
 }
 
 
+void AppendPDBLine(std::string& out, const Atomproperty& at, const Coord3D& co, uint maxwidth)
+{
+    size_t start = out.size();
+    out += "ATOM  ";
+    appendInt(out, at.GetAtomId(), 5);
+    out += "  ";
+    appendString(out, at.GetType(), 4, true);
+    appendString(out, at.GetResidType(), 3, false);
+    out += ' ';
+    appendString(out, at.GetChainId(), 1, false);
+    appendInt(out, at.GetResidId(), 4);
+    out += "    ";
+    appendFixed(out, real(co.x));
+    appendFixed(out, real(co.y));
+    appendFixed(out, real(co.z));
+    out += at.GetExtra();
+    if (maxwidth > 0 && out.size() - start > maxwidth) out.resize(start + maxwidth);
+    out += '\n';
+}
 
-void ReadPDB(const std::string name,Rigidbody& protein ) {
-    std::string nomfich=name ;
-	// pointer toward the filename given in the constructor argument
-    ifstream fichier(nomfich.c_str()); 
-    if (!fichier)
-    {
-        std::ostringstream oss;
-        throw std::invalid_argument("##### ReadPDB:Could not open file \"" + nomfich + "\" #####") ;
-//        exit(-1);
-    }
 
-    ReadPDB(fichier, protein);
-    fichier.close();
-    return;
 
+PDBWriter::PDBWriter(const std::string& filename, bool append, uint buffersize)
+        :m_buffersize(buffersize), m_nbmodels(0)
+{
+    m_file = fopen(filename.c_str(), append ? "a" : "w");
+    if (!m_file) throw std::invalid_argument("##### PDBWriter:Could not open file \"" + filename + "\" #####");
+    m_buffer.reserve(m_buffersize + 4096);
 }
 
-void WritePDB(const Rigidbody& rigid, std::string filename)
+
+PDBWriter::~PDBWriter()
+{
+    Close();
+}
+
+
+void PDBWriter::format(const Rigidbody& rigid, std::string& out)
 {
+    const Coord3D* coords = rigid.GetMovedCoords();
+    out.reserve(out.size() + 81*(size_t) rigid.Size());
+    for (uint i=0; i<rigid.Size(); i++)
+        AppendPDBLine(out, rigid.GetAtomProperty(i), coords[i]);
+}
 
-    FILE* file= fopen(filename.c_str(),"w") ;
 
-    for (uint i=0; i<rigid.Size();i++)
+void PDBWriter::append(const std::string& text, bool model)
+{
+    bool closed = false;
+    #pragma omp critical(PDBWriter)
     {
+        if (m_file)
+        {
+            m_buffer += text;
+            if (model) m_nbmodels++;
+            if (m_buffer.size() >= m_buffersize) flushBuffer();
+        }
+        else closed = true;
+    }
+    if (closed) throw std::runtime_error("PDBWriter: the file is closed");
+}
 
-        const char * chainID="A" ;
 
-        Atom at = rigid.CopyAtom(i);
-        const char* atomname=at.GetType().c_str();
-        const char* residName=at.GetResidType().c_str();
-        int residnumber = at.GetResidId();
-        chainID=at.GetChainId().c_str();
+void PDBWriter::flushBuffer()
+{
+    if (!m_buffer.empty()) fwrite(m_buffer.data(), 1, m_buffer.size(), m_file);
+    m_buffer.clear();
+}
 
-        int atomnumber = at.GetAtomId();
 
-        Coord3D coord = at.GetCoords();
-        dbl x = coord.x;
-        dbl y = coord.y;
-        dbl z = coord.z ;
+void PDBWriter::Write(const Rigidbody& rigid)
+{
+    std::string text;
+    format(rigid, text);
+    append(text, false);
+}
+
 
+void PDBWriter::WriteModel(const Rigidbody& rigid, int model)
+{
+    std::string text = "MODEL ";
+    appendInt(text, model, 8);
+    text += '\n';
+    format(rigid, text);
+    text += "ENDMDL\n";
+    append(text, true);
+}
 
 
-        fprintf(file,"ATOM  %5d  %-4s%3s %1s%4d    %8.3f%8.3f%8.3f%s",atomnumber,atomname,residName,chainID,residnumber,real(x),real(y),real(z),at.GetExtra().c_str());
-        fprintf(file,"\n");
+void PDBWriter::Flush()
+{
+    #pragma omp critical(PDBWriter)
+    {
+        if (m_file)
+        {
+            flushBuffer();
+            fflush(m_file);
+        }
     }
+}
+
 
-    fclose(file);
+void PDBWriter::Close()
+{
+    #pragma omp critical(PDBWriter)
+    {
+        if (m_file)
+        {
+            flushBuffer();
+            fclose(m_file);
+            m_file = 0;
+        }
+    }
+}
+
+
+void WritePDB(const Rigidbody& rigid, std::string filename)
+{
+    PDBWriter writer(filename);
+    writer.Write(rigid);
 }
 
 } //namespace PTools
@@ -2,6 +2,7 @@
 #define PDBIO_H
 
 #include <cctype>
+#include <cstdio>
 #include <fstream>
 #include <iomanip>
 #include <sstream>
@@ -17,10 +18,52 @@ namespace PTools
 
 
 
-void ReadPDB(std::ifstream& fichier,Rigidbody& protein ); ///< read a PDB file from a file pointer and load datas in Rigidbody
-void ReadPDB(const std::string name,Rigidbody& protein ); ///< read a PDB file from a filename and load datas in Rigidbody
+void ReadPDB(std::ifstream& fichier,Rigidbody& protein, bool attractfields=true ); ///< read a PDB file from a file pointer and load datas in Rigidbody
+void ReadPDB(const std::string name,Rigidbody& protein, bool attractfields=true ); ///< read a PDB file from a filename and load datas in Rigidbody (attractfields: also read the Attract category and charge of the extra fields)
 void WritePDB(const Rigidbody& rigid, std::string filename); ///< write a PDB file given a Rigidbody and a filename
 
+/// appends the ATOM line of an atom to out (lines longer than maxwidth characters are cut, 0: no limit)
+void AppendPDBLine(std::string& out, const Atomproperty& at, const Coord3D& co, uint maxwidth=0);
+
+
+/*! \brief buffered PDB output, for many structures in one file
+*
+*   ATOM lines are formatted without printf into a large buffer, which is written
+*   to the file when it exceeds buffersize bytes, on Flush() and on Close().
+*   WriteModel() surrounds the atoms with MODEL/ENDMDL records, so that
+*   thousands of docking poses can be streamed into a single file. A file
+*   opened with append=true is extended (for instance by successive runs).
+*
+*   A structure is formatted by the calling thread, then appended as a whole
+*   under an OpenMP lock: several threads may share one writer.
+*/
+class PDBWriter
+{
+public:
+    PDBWriter(const std::string& filename, bool append=false, uint buffersize=1<<20);
+    ~PDBWriter(); ///< flushes and closes the file
+
+    void Write(const Rigidbody& rigid); ///< ATOM lines only
+    void WriteModel(const Rigidbody& rigid, int model); ///< ATOM lines between MODEL and ENDMDL
+    uint NbModels() const {return m_nbmodels;}; ///< models written by this writer
+
+    void Flush(); ///< writes the buffer to the file
+    void Close();
+
+private:
+    PDBWriter(const PDBWriter&);
+    PDBWriter& operator=(const PDBWriter&);
+
+    static void format(const Rigidbody& rigid, std::string& out);
+    void append(const std::string& text, bool model);
+    void flushBuffer();
+
+    FILE* m_file;
+    std::string m_buffer;
+    uint m_buffersize;
+    uint m_nbmodels;
+};
+
 }
 
 #endif //#ifndef PDBIO_H
@@ -22,6 +22,10 @@
 #include "attractrigidbody.h"
 #include "mcopff.h"
 #include "superpose.h"
+#include "montecarlo.h"
+#include "clustering.h"
+#include "interfaceevaluator.h"
+#include "binaryio.h"
 #include "version.h"
 
 
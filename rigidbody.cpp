@@ -26,6 +26,7 @@
 #include "atomselection.h"
 #include "geometry.h"
 #include "pdbio.h"
+#include "binaryio.h"
 
 
 namespace PTools{
@@ -40,7 +41,10 @@ Rigidbody::Rigidbody()
 
 Rigidbody::Rigidbody(std::string filename)
 {
-    ReadPDB(filename,*this);
+    if (IsBinaryStructure(filename))
+        ReadBinaryStructure(filename,*this);
+    else
+        ReadPDB(filename,*this);
     ResetMatrix();
 }
 
@@ -283,12 +287,12 @@ std::string Rigidbody::PrintPDB() const
 {
     uint size=this->Size();
 
+    //same lines as Atom::ToPdbString(), appended to a single string
+    const Coord3D* coords = GetMovedCoords();
     std::string output;
+    output.reserve(81*(size_t) size);
     for (uint i=0; i < size ; i++)
-    {
-         Atom at(mAtomProp[i], this->GetCoords(i));
-         output = output + at.ToPdbString();
-    }
+         AppendPDBLine(output, mAtomProp[i], coords[i], 79);
     return output;
 }
 
@@ -107,6 +107,9 @@ public:
     /// add an atom to the molecule
     void AddAtom(const Atom& at);
 
+    /// reserves memory for n atoms (readers that know the number of atoms in advance)
+    void Reserve(uint n) {mAtomProp.reserve(n); CoordsArray::Reserve(n);};
+
     //returns the coordinates of atom i
     Coord3D GetCoords(uint i) const
     {
@@ -126,6 +129,9 @@ public:
       GetCoords(0);
     }
 
+    /// coordinates of all the atoms (no copy), valid until the next move of the rigidbody
+    const Coord3D* GetMovedCoords() const {return CoordsArray::movedCoords();}
+
 	/// define coordinates of atom i
     void SetCoords(uint i, const Coord3D& co)
     {
@@ -147,11 +153,23 @@ public:
     void ApplyMatrix(const Matrix & mat);
 
    /// get the 4x4 matrix
-   Matrix GetMatrix()
+   Matrix GetMatrix() const
    {
      return CoordsArray::GetMatrix();
    }
 
+   /// copy the 4x4 matrix into 'mat' (no allocation)
+   void CopyMatrix(dbl mat[4][4]) const
+   {
+     CoordsArray::CopyMatrix(mat);
+   }
+
+   /// reset the 4x4 matrix to identity: atoms go back to their initial coordinates
+   void ResetMatrix()
+   {
+     CoordsArray::ResetMatrix();
+   }
+
 
     /// returns radius of gyration
     dbl RadiusGyration();
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <cassert>
 #include <stdexcept>
+#include <algorithm>
 
 
 #include "rmsd.h"
@@ -9,6 +10,7 @@
 #include "rigidbody.h"
 
 #include "geometry.h" //for scalar product
+#include "superpose.h" //for qcpRmsd
 
 
 #define EPSILON 1e-3
@@ -32,18 +34,311 @@ dbl Rmsd(const AtomSelection& atsel1, const AtomSelection& atsel2)
 
     dbl sum = 0.0;
 
-
+    SelectionCoords c1 = atsel1.GetCoordsView();
+    SelectionCoords c2 = atsel2.GetCoordsView();
     for (uint i=0; i<atsel1.Size(); ++i)
+        sum += Norm2(c1[i] - c2[i]);
+
+    return sqrt(sum/(dbl) atsel1.Size()) ;
+
+
+}
+
+
+
+
+/// pairs of atoms processed together by RmsdMatrix: tiles of blocksize x blocksize structures
+static const uint RmsdBlockSize = 16;
+static const uint RmsdAtomChunk = 128;
+
+
+static void rmsdTile(const dbl* x, const dbl* y, const dbl* z, uint nstruct, uint natoms,
+                     uint bi, uint bj, dbl* out)
+{
+    uint iend = std::min(bi + RmsdBlockSize, nstruct);
+    uint jend = std::min(bj + RmsdBlockSize, nstruct);
+    dbl acc[RmsdBlockSize][RmsdBlockSize];
+    for (uint i=0; i<RmsdBlockSize; i++)
+        for (uint j=0; j<RmsdBlockSize; j++)
+            acc[i][j] = 0.0;
+
+    for (uint start=0; start<natoms; start+=RmsdAtomChunk)
     {
-        Atom atom1=atsel1.CopyAtom(i);
-        Atom atom2=atsel2.CopyAtom(i);
+        uint end = std::min(start + RmsdAtomChunk, natoms);
+        for (uint i=bi; i<iend; i++)
+        {
+            const dbl* xi = x + (size_t) i*natoms;
+            const dbl* yi = y + (size_t) i*natoms;
+            const dbl* zi = z + (size_t) i*natoms;
+            for (uint j=std::max(bj, i+1); j<jend; j++)
+            {
+                const dbl* xj = x + (size_t) j*natoms;
+                const dbl* yj = y + (size_t) j*natoms;
+                const dbl* zj = z + (size_t) j*natoms;
+                dbl sum = 0.0;
+                #pragma omp simd reduction(+:sum)
+                for (uint k=start; k<end; k++)
+                {
+                    dbl dx = xi[k]-xj[k], dy = yi[k]-yj[k], dz = zi[k]-zj[k];
+                    sum += dx*dx + dy*dy + dz*dz;
+                }
+                acc[i-bi][j-bj] += sum;
+            }
+        }
+    }
+
+    for (uint i=bi; i<iend; i++)
+        for (uint j=std::max(bj, i+1); j<jend; j++)
+            out[(size_t) i*nstruct - (size_t) i*(i+1)/2 + j-i-1] = sqrt(acc[i-bi][j-bj]/natoms);
+}
 
-        sum+=Dist2(atom1,atom2);
+
+/// same as rmsdTile() after superposition, for centered coordinates of square norms 'norms'
+static void fittedRmsdTile(const dbl* x, const dbl* y, const dbl* z, const dbl* norms, uint nstruct, uint natoms,
+                           uint bi, uint bj, dbl* out)
+{
+    uint iend = std::min(bi + RmsdBlockSize, nstruct);
+    uint jend = std::min(bj + RmsdBlockSize, nstruct);
+    dbl acc[RmsdBlockSize][RmsdBlockSize][9];
+    for (uint i=0; i<RmsdBlockSize; i++)
+        for (uint j=0; j<RmsdBlockSize; j++)
+            for (uint l=0; l<9; l++)
+                acc[i][j][l] = 0.0;
+
+    for (uint start=0; start<natoms; start+=RmsdAtomChunk)
+    {
+        uint end = std::min(start + RmsdAtomChunk, natoms);
+        for (uint i=bi; i<iend; i++)
+        {
+            const dbl* xi = x + (size_t) i*natoms;
+            const dbl* yi = y + (size_t) i*natoms;
+            const dbl* zi = z + (size_t) i*natoms;
+            for (uint j=std::max(bj, i+1); j<jend; j++)
+            {
+                const dbl* xj = x + (size_t) j*natoms;
+                const dbl* yj = y + (size_t) j*natoms;
+                const dbl* zj = z + (size_t) j*natoms;
+                dbl sxx=0, sxy=0, sxz=0, syx=0, syy=0, syz=0, szx=0, szy=0, szz=0;
+                #pragma omp simd reduction(+:sxx,sxy,sxz,syx,syy,syz,szx,szy,szz)
+                for (uint k=start; k<end; k++)
+                {
+                    sxx += xj[k]*xi[k]; sxy += xj[k]*yi[k]; sxz += xj[k]*zi[k];
+                    syx += yj[k]*xi[k]; syy += yj[k]*yi[k]; syz += yj[k]*zi[k];
+                    szx += zj[k]*xi[k]; szy += zj[k]*yi[k]; szz += zj[k]*zi[k];
+                }
+                dbl* a = acc[i-bi][j-bj];
+                a[0] += sxx; a[1] += sxy; a[2] += sxz;
+                a[3] += syx; a[4] += syy; a[5] += syz;
+                a[6] += szx; a[7] += szy; a[8] += szz;
+            }
+        }
     }
 
-    return sqrt(sum/(dbl) atsel1.Size()) ;
+    for (uint i=bi; i<iend; i++)
+        for (uint j=std::max(bj, i+1); j<jend; j++)
+        {
+            const dbl* a = acc[i-bi][j-bj];
+            Mat33 S = {{a[0], a[1], a[2]}, {a[3], a[4], a[5]}, {a[6], a[7], a[8]}};
+            out[(size_t) i*nstruct - (size_t) i*(i+1)/2 + j-i-1] = qcpRmsd(S, norms[i] + norms[j], natoms);
+        }
+}
+
+
+void RmsdMatrix(const dbl* x, const dbl* y, const dbl* z, uint nstruct, uint natoms, dbl* out, bool fit)
+{
+    if (natoms == 0) throw std::invalid_argument("EmptyRigidbody");
+
+    //centered copies for the superposition
+    std::vector<dbl> cx, cy, cz, norms;
+    if (fit)
+    {
+        size_t total = (size_t) nstruct*natoms;
+        cx.resize(total); cy.resize(total); cz.resize(total);
+        norms.assign(nstruct, 0.0);
+        for (uint s=0; s<nstruct; s++)
+        {
+            size_t first = (size_t) s*natoms;
+            dbl mx=0, my=0, mz=0;
+            for (uint k=0; k<natoms; k++)
+            {
+                mx += x[first+k]; my += y[first+k]; mz += z[first+k];
+            }
+            mx /= natoms; my /= natoms; mz /= natoms;
+            for (uint k=0; k<natoms; k++)
+            {
+                cx[first+k] = x[first+k]-mx;
+                cy[first+k] = y[first+k]-my;
+                cz[first+k] = z[first+k]-mz;
+                norms[s] += cx[first+k]*cx[first+k] + cy[first+k]*cy[first+k] + cz[first+k]*cz[first+k];
+            }
+        }
+    }
+
+    std::vector<std::pair<uint,uint> > tiles;
+    for (uint bi=0; bi<nstruct; bi+=RmsdBlockSize)
+        for (uint bj=bi; bj<nstruct; bj+=RmsdBlockSize)
+            tiles.push_back(std::make_pair(bi, bj));
+
+    int ntiles = tiles.size();
+    #pragma omp parallel for schedule(dynamic,1)
+    for (int t=0; t<ntiles; t++)
+    {
+        if (fit)
+            fittedRmsdTile(&cx[0], &cy[0], &cz[0], &norms[0], nstruct, natoms, tiles[t].first, tiles[t].second, out);
+        else
+            rmsdTile(x, y, z, nstruct, natoms, tiles[t].first, tiles[t].second, out);
+    }
+}
+
+
+std::vector<dbl> RmsdMatrix(const std::vector<Rigidbody>& structures, bool fit)
+{
+    uint nstruct = structures.size();
+    if (nstruct == 0) return std::vector<dbl>();
+    uint natoms = structures[0].Size();
+
+    std::vector<dbl> x((size_t) nstruct*natoms), y(x.size()), z(x.size());
+    for (uint s=0; s<nstruct; s++)
+    {
+        if (structures[s].Size() != natoms) throw std::invalid_argument("RmsdSizesDiffers");
+        for (uint k=0; k<natoms; k++)
+        {
+            Coord3D c = structures[s].GetCoords(k);
+            x[(size_t) s*natoms+k] = c.x;
+            y[(size_t) s*natoms+k] = c.y;
+            z[(size_t) s*natoms+k] = c.z;
+        }
+    }
+
+    std::vector<dbl> out((size_t) nstruct*(nstruct-1)/2);
+    RmsdMatrix(&x[0], &y[0], &z[0], nstruct, natoms, out.empty() ? 0 : &out[0], fit);
+    return out;
+}
+
+
+static void matrixToArray(const Matrix& m, dbl out[16])
+{
+    for (uint i=0; i<4; i++)
+        for (uint j=0; j<4; j++)
+            out[4*i+j] = m(i,j);
+}
+
+
+MatrixRmsd::MatrixRmsd(const Rigidbody& rig)
+{
+    init(rig);
+}
+
+
+MatrixRmsd::MatrixRmsd(const AtomSelection& sel)
+{
+    AtomSelection selection(sel);
+    init(selection.CreateRigid());
+}
+
+
+void MatrixRmsd::init(const Rigidbody& rig)
+{
+    if (rig.Size() == 0) throw std::invalid_argument("EmptyRigidbody");
+
+    uint size = rig.Size();
+    m_center = rig.FindCenter();
+
+    dbl cov[3][3] = {{0,0,0},{0,0,0},{0,0,0}};
+    for (uint k=0; k<size; k++)
+    {
+        Coord3D y = rig.GetCoords(k) - m_center;
+        dbl v[3] = {y.x, y.y, y.z};
+        for (uint i=0; i<3; i++)
+            for (uint j=0; j<3; j++)
+                cov[i][j] += v[i]*v[j];
+    }
+
+    //Cholesky factorization, null pivots (flat bodies) give null columns
+    for (uint i=0; i<3; i++)
+        for (uint j=0; j<3; j++)
+            m_L[i][j] = 0.0;
+    for (uint j=0; j<3; j++)
+    {
+        dbl d = cov[j][j]/size;
+        for (uint k=0; k<j; k++) d -= m_L[j][k]*m_L[j][k];
+        if (d <= 1e-12*(cov[0][0]+cov[1][1]+cov[2][2])/size) continue;
+        m_L[j][j] = sqrt(d);
+        for (uint i=j+1; i<3; i++)
+        {
+            dbl s = cov[i][j]/size;
+            for (uint k=0; k<j; k++) s -= m_L[i][k]*m_L[j][k];
+            m_L[i][j] = s/m_L[j][j];
+        }
+    }
+}
+
+
+void MatrixRmsd::embed(const dbl* m, dbl* point) const
+{
+    for (uint i=0; i<3; i++)
+    {
+        for (uint j=0; j<3; j++)
+            point[3*i+j] = m[4*i]*m_L[0][j] + m[4*i+1]*m_L[1][j] + m[4*i+2]*m_L[2][j];
+        point[9+i] = m[4*i]*m_center.x + m[4*i+1]*m_center.y + m[4*i+2]*m_center.z + m[4*i+3];
+    }
+}
+
+
+dbl MatrixRmsd::rmsd(const dbl* m1, const dbl* m2) const
+{
+    dbl p1[EmbeddingSize], p2[EmbeddingSize];
+    embed(m1, p1);
+    embed(m2, p2);
+    dbl sum = 0.0;
+    for (uint i=0; i<EmbeddingSize; i++)
+        sum += (p1[i]-p2[i])*(p1[i]-p2[i]);
+    return sqrt(sum);
+}
+
+
+dbl MatrixRmsd::rmsd(const Matrix& m1, const Matrix& m2) const
+{
+    dbl a1[16], a2[16];
+    matrixToArray(m1, a1);
+    matrixToArray(m2, a2);
+    return rmsd(a1, a2);
+}
 
 
+void MatrixRmsd::allPairs(const dbl* matrices, uint n, dbl* out) const
+{
+    std::vector<dbl> points(EmbeddingSize*(size_t) n);
+    for (uint i=0; i<n; i++)
+        embed(matrices + 16*(size_t) i, &points[EmbeddingSize*(size_t) i]);
+
+    int nposes = n;
+    #pragma omp parallel for schedule(dynamic,16)
+    for (int i=0; i<nposes; i++)
+    {
+        const dbl* pi = &points[EmbeddingSize*(size_t) i];
+        out[(size_t) i*n+i] = 0.0;
+        for (uint j=i+1; j<n; j++)
+        {
+            const dbl* pj = &points[EmbeddingSize*(size_t) j];
+            dbl sum = 0.0;
+            for (uint k=0; k<EmbeddingSize; k++)
+                sum += (pi[k]-pj[k])*(pi[k]-pj[k]);
+            out[(size_t) i*n+j] = out[(size_t) j*n+i] = sqrt(sum);
+        }
+    }
+}
+
+
+std::vector<dbl> MatrixRmsd::allPairs(const std::vector<Matrix>& poses) const
+{
+    uint n = poses.size();
+    std::vector<dbl> matrices(16*(size_t) n);
+    for (uint i=0; i<n; i++)
+        matrixToArray(poses[i], &matrices[16*(size_t) i]);
+    std::vector<dbl> out((size_t) n*n);
+    if (n > 0) allPairs(&matrices[0], n, &out[0]);
+    return out;
 }
 
 
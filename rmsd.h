@@ -18,6 +18,55 @@ namespace PTools
 dbl Rmsd(const AtomSelection& atsel1, const AtomSelection& atsel2);
 
 
+/*! \brief RMSD between all the pairs of nstruct structures of natoms atoms
+*
+*   coordinates are given in SoA layout: x[s*natoms+k] is the x coordinate of atom k
+*   of structure s. out receives the condensed matrix of the nstruct*(nstruct-1)/2
+*   pairs (i,j), i<j, the pair (i,j) being at index i*nstruct - i*(i+1)/2 + j-i-1.
+*   With fit=true, RMSDs are computed after optimal superposition (see superpose()).
+*   Pairs are computed by tiles of structures and atoms, in parallel (OpenMP).
+*/
+void RmsdMatrix(const dbl* x, const dbl* y, const dbl* z, uint nstruct, uint natoms, dbl* out, bool fit=false);
+///same for rigidbodies of the same size, returns the condensed matrix
+std::vector<dbl> RmsdMatrix(const std::vector<Rigidbody>& structures, bool fit=false);
+/*! \brief RMSD between two poses of the same rigid body, from their 4x4 matrices
+*
+*   with c the center of the body and Cov = L L^T the covariance of its atoms,
+*   the pose (R,t) is embedded as the 12 values (R L, R c + t): the RMSD between
+*   two poses is the euclidean distance between their embeddings. The moments
+*   are computed once, then each RMSD costs a constant time whatever the number
+*   of atoms.
+*/
+class MatrixRmsd
+{
+public:
+    enum {EmbeddingSize = 12};
+
+    MatrixRmsd(const Rigidbody& rig);
+    MatrixRmsd(const AtomSelection& sel);
+
+    ///rmsd (no superposition) between the body moved by m1 and the body moved by m2
+    dbl rmsd(const Matrix& m1, const Matrix& m2) const;
+    ///same with matrices given as 16 values (row major)
+    dbl rmsd(const dbl* m1, const dbl* m2) const;
+
+    ///12 values such that rmsd(m1, m2) = |embed(m1) - embed(m2)| (m: 16 values, row major)
+    void embed(const dbl* m, dbl* point) const;
+
+    ///rmsd between all the pairs of n matrices of 16 values: out[i*n+j] (n*n values)
+    void allPairs(const dbl* matrices, uint n, dbl* out) const;
+    std::vector<dbl> allPairs(const std::vector<Matrix>& poses) const;
+
+    Coord3D center() const {return m_center;};
+
+private:
+    void init(const Rigidbody& rig);
+
+    Coord3D m_center;
+    dbl m_L[3][3]; ///< lower triangular, L L^T = covariance of the atoms
+};
+
+
 }
 
 #endif //RSMD_H
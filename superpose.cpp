@@ -28,6 +28,7 @@
 #include <cassert>
 #include <time.h>
 #include <stdlib.h> //drand
+#include <stdexcept>
 
 #include "superpose.h"
 #include "geometry.h" // for ScalProd 
@@ -55,77 +56,6 @@ static void PrintMat(Mat33 mat)
 
 
 
-static void Mat33xMat33(Mat33 left, Mat33 right, Mat33 out) //matrix multiplication. Works with out==left or out==right
-{
-    Mat33 tmp;
-    for (uint k=0; k<3; k++)
-        for (uint l=0; l<3; l++)
-        {
-            tmp[k][l]=0;
-            for (uint i=0; i<3;i++)
-                tmp[k][l] += left[k][i]*right[i][l];
-        }
-
-    //recopie de la matrice temporaire:
-    for(uint i=0; i<3;i++)
-        for(uint j=0;j<3;j++)
-            out[i][j]=tmp[i][j];
-
-}
-
-
-static void XRotMatrix(double theta, Mat33 out)
-{
-    out[0][0]=1;
-    out[0][1]=0;
-    out[0][2]=0;
-
-    out[1][0]=0;
-    out[1][1]=cos(theta);
-    out[1][2]=-sin(theta);
-
-    out[2][0]=0;
-    out[2][1]=sin(theta);
-    out[2][2]=cos(theta);
-
-}
-
-
-static void YRotMatrix(double theta, Mat33 out)
-{
-    out[0][0]=cos(theta);
-    out[0][1]=0;
-    out[0][2]=sin(theta);
-
-    out[1][0]=0;
-    out[1][1]=1;
-    out[1][2]=0;
-
-    out[2][0]=-sin(theta);
-    out[2][1]=0;
-    out[2][2]=cos(theta);
-
-}
-
-
-
-static void ZRotMatrix(double theta, Mat33 out)
-{
-    out[0][0]=cos(theta);
-    out[0][1]=-sin(theta);
-    out[0][2]=0;
-
-    out[1][0]=sin(theta);
-    out[1][1]=cos(theta);
-    out[1][2]=0;
-
-    out[2][0]=0;
-    out[2][1]=0;
-    out[2][2]=1;
-}
-
-
-
 void Rotate(Rigidbody& rigid, Mat33 mat)
 {
     double x,y,z;
@@ -165,49 +95,194 @@ static void Mat33xcoord3D(Mat33 mat, Coord3D& in, Coord3D& out)
 
 
 
-static void rigidToMatrix(const Rigidbody & rig, double output[][3])
+static inline Coord3D coordsOf(const Rigidbody& rig, uint i) {return rig.GetCoords(i);}
+static inline Coord3D coordsOf(const Coord3D* coords, uint i) {return coords[i];}
+static inline Coord3D coordsOf(const SelectionCoords& coords, uint i) {return coords[i];}
+
+
+/**
+Centers of ref and mob, inner product matrix S[i][j] = sum mob_i*ref_j
+and sum of the square norms G of the centered coordinates.
+ */
+template <class Coords>
+static void innerProduct(const Coords& ref, const Coords& mob, uint size, Coord3D& cref, Coord3D& cmob, Mat33 S, double& G)
 {
-    for (uint atom=0; atom<rig.Size();atom++)
+    cref = Coord3D();
+    cmob = Coord3D();
+    for (uint k=0; k<size; k++)
     {
-        Coord3D c = rig.GetCoords(atom);
-        output[atom][0]=c.x;
-        output[atom][1]=c.y;
-        output[atom][2]=c.z;
+        cref += coordsOf(ref, k);
+        cmob += coordsOf(mob, k);
     }
+    cref = cref / (double) size;
+    cmob = cmob / (double) size;
+
+    for (uint i=0; i<3; i++)
+        for (uint j=0; j<3; j++)
+            S[i][j] = 0.0;
+    G = 0.0;
 
+    for (uint k=0; k<size; k++)
+    {
+        Coord3D a = coordsOf(ref, k) - cref;
+        Coord3D b = coordsOf(mob, k) - cmob;
+        S[0][0] += b.x*a.x; S[0][1] += b.x*a.y; S[0][2] += b.x*a.z;
+        S[1][0] += b.y*a.x; S[1][1] += b.y*a.y; S[1][2] += b.y*a.z;
+        S[2][0] += b.z*a.x; S[2][1] += b.z*a.y; S[2][2] += b.z*a.z;
+        G += Norm2(a) + Norm2(b);
+    }
 }
 
 
+static double det3(double a, double b, double c, double d, double e, double f, double g, double h, double i)
+{
+    return a*(e*i - f*h) - b*(d*i - f*g) + c*(d*h - e*g);
+}
 
 
 /**
-Calculates the tensor, as described by Sippl.
+Quaternion characteristic polynomial (QCP): the largest eigenvalue of Horn's
+4x4 key matrix K (output) is found by Newton iterations on its characteristic polynomial.
+Theobald, Acta Cryst. A61, 478-480 (2005). Liu et al., J. Comput. Chem. 31, 1561-1563 (2010).
  */
-static void MakeTensor( Rigidbody & ref, Rigidbody & mob, Mat33 out)
+static double qcpEigenvalue(Mat33 S, double G, double K[4][4])
 {
-
-    if (ref.Size()!=mob.Size())
+    double Sxx = S[0][0], Sxy = S[0][1], Sxz = S[0][2];
+    double Syx = S[1][0], Syy = S[1][1], Syz = S[1][2];
+    double Szx = S[2][0], Szy = S[2][1], Szz = S[2][2];
+
+    const double key[4][4] = {
+        {Sxx+Syy+Szz, Syz-Szy,      Szx-Sxz,      Sxy-Syx},
+        {Syz-Szy,     Sxx-Syy-Szz,  Sxy+Syx,      Szx+Sxz},
+        {Szx-Sxz,     Sxy+Syx,      -Sxx+Syy-Szz, Syz+Szy},
+        {Sxy-Syx,     Szx+Sxz,      Syz+Szy,      -Sxx-Syy+Szz}};
+    for (uint i=0; i<4; i++)
+        for (uint j=0; j<4; j++)
+            K[i][j] = key[i][j];
+
+    //P(l) = l^4 + c2 l^2 + c1 l + c0
+    double c2 = 0.0;
+    for (uint i=0; i<3; i++)
+        for (uint j=0; j<3; j++)
+            c2 -= 2.0*S[i][j]*S[i][j];
+    double c1 = -8.0*det3(Sxx, Sxy, Sxz, Syx, Syy, Syz, Szx, Szy, Szz);
+    double c0 = K[0][0]*det3(K[1][1], K[1][2], K[1][3], K[2][1], K[2][2], K[2][3], K[3][1], K[3][2], K[3][3])
+              - K[0][1]*det3(K[1][0], K[1][2], K[1][3], K[2][0], K[2][2], K[2][3], K[3][0], K[3][2], K[3][3])
+              + K[0][2]*det3(K[1][0], K[1][1], K[1][3], K[2][0], K[2][1], K[2][3], K[3][0], K[3][1], K[3][3])
+              - K[0][3]*det3(K[1][0], K[1][1], K[1][2], K[2][0], K[2][1], K[2][2], K[3][0], K[3][1], K[3][2]);
+
+    //G/2 is an upper bound of the largest eigenvalue: Newton converges to it from above
+    double lambda = 0.5*G;
+    for (uint iter=0; iter<50; iter++)
     {
-        std::string msg = "in superpose.cpp, in MakeTensor: Error, the two rigidbodies must have the same size !!!\n";
-        std::runtime_error fail(msg);
-        throw fail;
+        double l2 = lambda*lambda;
+        double p = l2*l2 + c2*l2 + c1*lambda + c0;
+        double dp = 4.0*l2*lambda + 2.0*c2*lambda + c1;
+        if (dp == 0.0) break;
+        double step = p/dp;
+        lambda -= step;
+        if (fabs(step) <= 1e-11*fabs(lambda)) break;
     }
 
-    //get coordinates into an array
-    double cref[ref.Size()][3];
-    double cmob[mob.Size()][3];
-    rigidToMatrix(ref,cref);
-    rigidToMatrix(mob,cmob);
+    return lambda;
+}
+
 
+dbl qcpRmsd(Mat33 S, dbl G, uint size)
+{
+    double K[4][4];
+    double msd = (G - 2.0*qcpEigenvalue(S, G, K)) / (double) size;
+    return (msd > 0.0) ? sqrt(msd) : 0.0;
+}
 
-    for (uint c=0; c<3; c++)
-        for(uint l=0;l<3; l++)
+
+/**
+Rotation rot minimizing sum |rot.mob - ref|^2 for centered coordinates, from their
+inner product matrix S and the sum of their square norms G (see innerProduct()).
+The rmsd is obtained without a second pass over the coordinates, the rotation
+comes from the eigenvector of the largest eigenvalue (a column of adj(K - lambda I)).
+ */
+static void fitInnerProduct(Mat33 S, double G, uint size, Mat33 rot, double& rmsd)
+{
+    double K[4][4];
+    double lambda = qcpEigenvalue(S, G, K);
+
+    //eigenvector: largest column of the adjugate of K - lambda I
+    double A[4][4];
+    for (uint i=0; i<4; i++)
+        for (uint j=0; j<4; j++)
+            A[i][j] = K[i][j] - ((i==j) ? lambda : 0.0);
+
+    double q[4] = {1.0, 0.0, 0.0, 0.0};
+    double best = 0.0;
+    for (uint col=0; col<4; col++)
+    {
+        //cofactors of row 'col' of A give column 'col' of adj(A)
+        uint r[3], n = 0;
+        for (uint i=0; i<4; i++) if (i != col) r[n++] = i;
+        double v[4];
+        for (uint j=0; j<4; j++)
         {
-            out[l][c]=0;
-            for (uint k=0;k<ref.Size();k++)
-                out[l][c]+=cref[k][c]*cmob[k][l];
+            uint c[3], m = 0;
+            for (uint i=0; i<4; i++) if (i != j) c[m++] = i;
+            double minor = det3(A[r[0]][c[0]], A[r[0]][c[1]], A[r[0]][c[2]],
+                                A[r[1]][c[0]], A[r[1]][c[1]], A[r[1]][c[2]],
+                                A[r[2]][c[0]], A[r[2]][c[1]], A[r[2]][c[2]]);
+            v[j] = ((col+j) % 2 == 0) ? minor : -minor;
         }
+        double norm2 = v[0]*v[0] + v[1]*v[1] + v[2]*v[2] + v[3]*v[3];
+        if (norm2 > best)
+        {
+            best = norm2;
+            for (uint j=0; j<4; j++) q[j] = v[j];
+        }
+    }
+
+    //degenerate case (multiple largest eigenvalue, or nothing to fit): the
+    //cofactors (of order G^3) vanish up to rounding errors, identity is used
+    double scale = G*G*G;
+    if (best <= 1e-20*scale*scale)
+    {
+        q[0] = 1.0; q[1] = q[2] = q[3] = 0.0;
+        best = 1.0;
+    }
+    double norm = sqrt(best);
+    double w = q[0]/norm, x = q[1]/norm, y = q[2]/norm, z = q[3]/norm;
+
+    //rmsd of the returned rotation: G - 2 q.K.q (lambda for an exact eigenvector)
+    double qn[4] = {w, x, y, z};
+    double qkq = 0.0;
+    for (uint i=0; i<4; i++)
+        for (uint j=0; j<4; j++)
+            qkq += qn[i]*K[i][j]*qn[j];
+    double msd = (G - 2.0*qkq) / (double) size;
+    rmsd = (msd > 0.0) ? sqrt(msd) : 0.0;
+
+    rot[0][0] = w*w + x*x - y*y - z*z; rot[0][1] = 2.0*(x*y - w*z);         rot[0][2] = 2.0*(x*z + w*y);
+    rot[1][0] = 2.0*(x*y + w*z);         rot[1][1] = w*w - x*x + y*y - z*z; rot[1][2] = 2.0*(y*z - w*x);
+    rot[2][0] = 2.0*(x*z - w*y);         rot[2][1] = 2.0*(y*z + w*x);         rot[2][2] = w*w - x*x - y*y + z*z;
+}
+
 
+/**
+4x4 matrix that rotates mob around its center cmob then moves it to cref
+*/
+static Matrix fitMatrix(Mat33 rot, const Coord3D& cref, const Coord3D& cmob)
+{
+    Matrix output(4,4);
+    Coord3D t;
+    t.x = cref.x - (rot[0][0]*cmob.x + rot[0][1]*cmob.y + rot[0][2]*cmob.z);
+    t.y = cref.y - (rot[1][0]*cmob.x + rot[1][1]*cmob.y + rot[1][2]*cmob.z);
+    t.z = cref.z - (rot[2][0]*cmob.x + rot[2][1]*cmob.y + rot[2][2]*cmob.z);
+    for (uint i=0; i<3; i++)
+        for (uint j=0; j<3; j++)
+            output(i,j) = rot[i][j];
+    output(0,3) = t.x;
+    output(1,3) = t.y;
+    output(2,3) = t.z;
+    output(3,0) = output(3,1) = output(3,2) = 0.0;
+    output(3,3) = 1.0;
+    return output;
 }
 
 
@@ -386,139 +461,184 @@ Screw MatTrans2screw(const Matrix& mat)
 
 /** \brief Superpose mob on ref
 Calculates a 4x4 transformation Matrix that should be applied on 'mob' in order to minimize
-RMSD between mob and ref.
-Algorithm taken from Sippl et Stegbuchner. Computers Chem. Vol 15, No. 1, p 73-78, 1991.
+RMSD between mob and ref, and this RMSD.
+Closed-form quaternion fit (see fitInnerProduct()), the rigidbodies are not copied.
 */
 Superpose_t superpose(const Rigidbody& ref, const Rigidbody& mob, int verbosity)
 {
-
-    Rigidbody reference(ref); //copie de ref pour pouvoir centrer
-    Rigidbody mobile(mob); // copie de mobile
-
     if (ref.Size()!=mob.Size()) {std::cout << "Error in superpose.cpp: \
                                        the two AtomSelection objects must have\
                                        the same size !" << std::endl;  abort();};
 
+    Coord3D cref, cmob;
+    Mat33 S, rot;
+    double G;
+    innerProduct(ref, mob, ref.Size(), cref, cmob, S, G);
 
-    Mat33 rot;
-    Mat33 ident;
-    for (uint i=0; i<3; i++)
-        for(uint j=0; j<3; j++)
-        if (i!=j) {ident[i][j]=0;} else {ident[i][j]=1;} ;
-
-
-    //find the translational component 
-    Coord3D t0 = ref.FindCenter();
-    Coord3D t1 = mob.FindCenter();
-
-
-    //centre les deux objets:
-    reference.CenterToOrigin();
-    mobile.CenterToOrigin();
-
-
-    Mat33 U; //mixed tensor
-    MakeTensor(reference, mobile, U);
+    Superpose_t sup;
+    fitInnerProduct(S, G, ref.Size(), rot, sup.rmsd);
+    sup.matrix = fitMatrix(rot, cref, cmob);
+    return sup;
+}
 
-    for(uint i=0; i<35; i++)
-    {
 
-        double arg1,arg2;
+Superpose_t superpose(const AtomSelection& ref, const AtomSelection& mob, int verbosity)
+{
+    if (ref.Size() != mob.Size()) throw std::invalid_argument("superpose: the two selections must have the same size");
+    if (ref.Size() == 0) throw std::invalid_argument("superpose: empty selection");
 
-        arg1 = U[2][1] - U[1][2] ;
-        arg2 = U[1][1] + U[2][2];
-        double alpha = atan2(arg1 , arg2 );
+    SelectionCoords cref = ref.GetCoordsView();
+    SelectionCoords cmob = mob.GetCoordsView();
 
-        XRotMatrix(-alpha, rot);
-        Mat33xMat33(rot,ident,ident);
+    Coord3D centerref, centermob;
+    Mat33 S, rot;
+    double G;
+    innerProduct(cref, cmob, ref.Size(), centerref, centermob, S, G);
 
-        //------------------------------------
+    Superpose_t sup;
+    fitInnerProduct(S, G, ref.Size(), rot, sup.rmsd);
+    sup.matrix = fitMatrix(rot, centerref, centermob);
+    return sup;
+}
 
 
-        Mat33xMat33(rot,U,U);
+Superpose_t superposeCoords(const Coord3D* ref, const Coord3D* mob, uint size)
+{
+    if (size == 0) throw std::invalid_argument("superposeCoords: no coordinates");
 
-        arg1 = U[2][0]-U[0][2];
-        arg2 = U[0][0]+U[2][2];
+    Coord3D cref, cmob;
+    Mat33 S, rot;
+    double G;
+    innerProduct(ref, mob, size, cref, cmob, S, G);
 
-        double beta = atan2(arg1,arg2);
-        YRotMatrix(beta,rot);
-        Mat33xMat33(rot,ident,ident);
+    Superpose_t sup;
+    fitInnerProduct(S, G, size, rot, sup.rmsd);
+    sup.matrix = fitMatrix(rot, cref, cmob);
+    return sup;
+}
 
-        //--------------------------------------
 
 
-        Mat33xMat33(rot,U,U);
 
-        arg1 = U[1][0] - U[0][1];
-        arg2 = U[0][0] + U[1][1];
-        double gamma = atan2(arg1,arg2);
+Superposer::Superposer(const Rigidbody& ref)
+{
+    std::vector<Coord3D> coords(ref.Size());
+    for (uint i=0; i<ref.Size(); i++)
+        coords[i] = ref.GetCoords(i);
+    init(coords);
+}
 
-        ZRotMatrix(-gamma,rot);
-        Mat33xMat33(rot,ident,ident);
 
+Superposer::Superposer(const std::vector<Coord3D>& ref)
+{
+    init(ref);
+}
 
-        Mat33xMat33(rot,U,U);
 
+void Superposer::init(const std::vector<Coord3D>& ref)
+{
+    if (ref.empty()) throw std::invalid_argument("Superposer: empty reference");
+
+    uint size = ref.size();
+    m_center = Coord3D();
+    for (uint i=0; i<size; i++) m_center += ref[i];
+    m_center = m_center / (double) size;
+
+    m_x.resize(size);
+    m_y.resize(size);
+    m_z.resize(size);
+    m_norm2 = 0.0;
+    for (uint i=0; i<size; i++)
+    {
+        Coord3D a = ref[i] - m_center;
+        m_x[i] = a.x;
+        m_y[i] = a.y;
+        m_z[i] = a.z;
+        m_norm2 += Norm2(a);
     }
-
-    //creates a 4x4 matrix that tracks transformations for mobile
-    Mat44 tracker;
-    MakeTranslationMat44(Coord3D()-t1,tracker);
-
-    //copy the 3x3 matrix into a 4x4 matrix
-    Mat44 rotation;
-    MakeTranslationMat44(Coord3D(),rotation); //identity matrix;
-    for (int i=0; i<3; i++)
-      for (int j=0; j<3; j++)
-         rotation[i][j]=ident[i][j];
+}
 
 
+void Superposer::fitOne(const Coord3D* mob, dbl* matrix, dbl& rmsd) const
+{
+    const uint size = m_x.size();
+    const double* ax = &m_x[0];
+    const double* ay = &m_y[0];
+    const double* az = &m_z[0];
+
+    //the reference is centered: sum (b-cmob).a = sum b.a, thus one pass is enough.
+    //coordinates are taken relative to the first atom to limit cancellations
+    const Coord3D origin = mob[0];
+    double sx=0, sy=0, sz=0, bb=0;
+    double xx=0, xy=0, xz=0, yx=0, yy=0, yz=0, zx=0, zy=0, zz=0;
+    for (uint k=0; k<size; k++)
+    {
+        double bx = mob[k].x - origin.x;
+        double by = mob[k].y - origin.y;
+        double bz = mob[k].z - origin.z;
+        sx += bx; sy += by; sz += bz;
+        bb += bx*bx + by*by + bz*bz;
+        xx += bx*ax[k]; xy += bx*ay[k]; xz += bx*az[k];
+        yx += by*ax[k]; yy += by*ay[k]; yz += by*az[k];
+        zx += bz*ax[k]; zy += bz*ay[k]; zz += bz*az[k];
+    }
 
-    mat44xmat44(rotation, tracker, tracker);
+    Mat33 S = {{xx, xy, xz}, {yx, yy, yz}, {zx, zy, zz}};
+    Coord3D shift(sx/size, sy/size, sz/size);
+    double G = m_norm2 + bb - size*Norm2(shift);
 
-    MakeTranslationMat44(t0, rotation);
-    mat44xmat44(rotation, tracker, tracker);
+    Mat33 rot;
+    fitInnerProduct(S, G, size, rot, rmsd);
 
-    Matrix output(4,4);
+    Matrix m = fitMatrix(rot, m_center, origin + shift);
+    for (uint i=0; i<4; i++)
+        for (uint j=0; j<4; j++)
+            matrix[4*i+j] = m(i,j);
+}
 
-    for (int i=0; i<4; i++)
-     for (int j=0; j<4;j++)
-       output(i,j)=tracker[i][j];
 
+Superpose_t Superposer::fit(const Coord3D* mob) const
+{
+    dbl matrix[16];
     Superpose_t sup;
-    sup.matrix = output;
-
-    Rigidbody probe(mob);
-    probe.ApplyMatrix(output);
-
-    sup.rmsd = Rmsd(ref,probe);
+    fitOne(mob, matrix, sup.rmsd);
+    sup.matrix = Matrix(4,4);
+    for (uint i=0; i<4; i++)
+        for (uint j=0; j<4; j++)
+            sup.matrix(i,j) = matrix[4*i+j];
     return sup;
+}
 
 
+Superpose_t Superposer::fit(const Rigidbody& mob) const
+{
+    if (mob.Size() != Size()) throw std::invalid_argument("Superposer::fit: the mobile and reference sizes differ");
+    std::vector<Coord3D> coords(Size());
+    for (uint i=0; i<Size(); i++)
+        coords[i] = mob.GetCoords(i);
+    return fit(&coords[0]);
+}
 
-//     screw = MatTrans2screw(ident, t0, t1);
-//     screw.point = screw.point + t1 ;
-
-
-
-
-/*
-    if (verbosity==1)
-    {
-
-
-        Rigidbody newmob(mob);
-        Rigidbody newref(ref);
-        selref.setRigid(newref);
-        selmob.setRigid(newmob);
-        newmob.transform(screw);
 
-        std::cout << "verif screw, rmsdca = " << rmsd(selmob && CA(newmob),selref && CA(newref)) << std::endl ;
+void Superposer::fit(const Coord3D* mobiles, uint nmodels, dbl* matrices, dbl* rmsds) const
+{
+    const uint size = Size();
+    int n = nmodels;
+    #pragma omp parallel for schedule(static)
+    for (int i=0; i<n; i++)
+        fitOne(mobiles + (size_t) i*size, matrices + 16*(size_t) i, rmsds[i]);
+}
 
-    }
-*/
 
-//     return screw;
+void Superposer::fit(const std::vector<Coord3D>& mobiles, std::vector<dbl>& matrices, std::vector<dbl>& rmsds) const
+{
+    if (mobiles.size() % Size() != 0)
+        throw std::invalid_argument("Superposer::fit: the number of coordinates is not a multiple of the reference size");
+    uint nmodels = mobiles.size() / Size();
+    matrices.resize(16*nmodels);
+    rmsds.resize(nmodels);
+    if (nmodels == 0) return;
+    fit(&mobiles[0], nmodels, &matrices[0], &rmsds[0]);
 }
 
 
@@ -29,6 +29,7 @@
 #include "screw.h"
 
 #include "rigidbody.h"
+#include "atomselection.h"
 
 
 namespace PTools
@@ -44,6 +45,51 @@ void Mat44toMat33trans(Mat44 mat44, Mat33 mat33, Coord3D& trans);
 Screw MatTrans2screw(const Matrix& mat); // transforme t(r(X)) en un vissage d'axe de rotation colineaire au vecteur translation.
 
 Superpose_t superpose(const Rigidbody& ref, const Rigidbody& mob, int verbosity=0);
+/// superpose the selected atoms (no copy of the coordinates)
+Superpose_t superpose(const AtomSelection& ref, const AtomSelection& mob, int verbosity=0);
+
+/// rmsd after superposition of centered coordinates, from S[i][j] = sum mob_i*ref_j and the sum G of their square norms
+dbl qcpRmsd(Mat33 S, dbl G, uint size);
+
+/// superpose mob on ref given as arrays of 'size' coordinates (no copy)
+Superpose_t superposeCoords(const Coord3D* ref, const Coord3D* mob, uint size);
+
+
+/*! \brief superposition of many mobile structures onto the same reference
+*
+*   the reference is centered once. Each mobile structure is then fitted in a
+*   single pass over its coordinates (see superpose()), and batches of models
+*   are fitted in parallel (OpenMP).
+*/
+class Superposer
+{
+public:
+    Superposer(): m_norm2(0.0) {}; ///< empty reference, to be assigned
+    Superposer(const Rigidbody& ref);
+    Superposer(const std::vector<Coord3D>& ref);
+
+    uint Size() const {return m_x.size();}; ///< number of atoms of the reference
+
+    Superpose_t fit(const Rigidbody& mob) const;
+    Superpose_t fit(const Coord3D* mob) const; ///< mob: Size() coordinates
+
+    /*! \brief fits nmodels structures of Size() coordinates stored one after the other
+    *
+    *   matrices receives the 4x4 matrices (16 values per model, row major) and
+    *   rmsds one value per model.
+    */
+    void fit(const Coord3D* mobiles, uint nmodels, dbl* matrices, dbl* rmsds) const;
+    void fit(const std::vector<Coord3D>& mobiles, std::vector<dbl>& matrices, std::vector<dbl>& rmsds) const;
+
+private:
+    void init(const std::vector<Coord3D>& ref);
+    void fitOne(const Coord3D* mob, dbl* matrix, dbl& rmsd) const;
+
+    //centered reference, one array per component
+    std::vector<dbl> m_x, m_y, m_z;
+    Coord3D m_center;
+    dbl m_norm2; ///< sum of the square norms of the centered reference
+};
 
 }
 
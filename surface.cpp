@@ -3,6 +3,9 @@
 #include "attractrigidbody.h"
 
 #include <cassert>
+#include <algorithm>
+#include <stdexcept>
+#include <sstream>
 
 namespace PTools
 {
@@ -34,46 +37,177 @@ void Surface::surfpointParams(int max, dbl shift)
     m_init=true;
 }
 
+void ReadSolvationParameters(const std::string& file, std::vector<dbl>& radius, std::vector<dbl>& param)
+{
+    std::ifstream sfile(file.c_str());
+    if (!sfile)
+        throw std::invalid_argument("##### ReadSolvationParameters:Could not open file \"" + file + "\" #####");
+
+    radius.clear();
+    param.clear();
+    std::vector<bool> found;
+
+    std::string line;
+    while (std::getline(sfile, line))
+    {
+        std::istringstream fields(line);
+        int type;
+        dbl rad, sigma;
+        if (!(fields >> type >> rad >> sigma)) continue;
+        if (type < 1)
+            throw std::invalid_argument("##### ReadSolvationParameters:atom types start at 1 in \"" + file + "\" #####");
+
+        uint t = type - 1;
+        if (t >= found.size())
+        {
+            found.resize(t+1, false);
+            radius.resize(t+1, 0.0);
+            param.resize(t+1, 0.0);
+        }
+        if (found[t])
+            throw std::invalid_argument("##### ReadSolvationParameters:atom type given twice in \"" + file + "\" #####");
+        found[t] = true;
+        radius[t] = rad;
+        param[t] = sigma;
+    }
+
+    if (std::find(found.begin(), found.end(), false) != found.end())
+        throw std::invalid_argument("##### ReadSolvationParameters:missing atom type in \"" + file + "\" #####");
+}
+
+
 void Surface::readsolvparam(const std::string& file)
 {
-    std::string line ;
-    //int count = 0;
-    radi.clear();
+    std::vector<dbl> params;
+    ReadSolvationParameters(file, radi, params);
+}
 
-    std::ifstream sfile(file.c_str());
-    if (! sfile)
+/*! \brief atoms sorted by the cells of a regular grid (cell list)
+*
+*   two points closer than the cell size are in the same cell or in one of the
+*   26 surrounding cells: the neighbour search does not depend on the total
+*   number of atoms.
+*/
+class SurfaceCellList
+{
+public:
+
+    SurfaceCellList(const std::vector<Coord3D>& coords, dbl cellsize)
+    {
+        uint size = coords.size();
+        m_min = Coord3D(0.0, 0.0, 0.0);
+        Coord3D max = m_min;
+        if (size > 0) {m_min = coords[0]; max = coords[0];}
+        for (uint i=1; i<size; i++)
         {
-            //  the file cannot be opened
-            std::string msg = " Cannot Locate file ";
-	    msg.append(file.c_str());
-	    msg.append("\n");
-            std::cerr << msg ;
-            throw msg;
-	}
+            const Coord3D& c = coords[i];
+            m_min.x = std::min(m_min.x, c.x); m_min.y = std::min(m_min.y, c.y); m_min.z = std::min(m_min.z, c.z);
+            max.x = std::max(max.x, c.x); max.y = std::max(max.y, c.y); max.z = std::max(max.z, c.z);
+        }
 
-    while (std::getline(sfile, line))
+        //larger cells are slower but always correct: keep the number of cells reasonable
+        m_cellsize = std::max(cellsize, 1.0);
+        do
+        {
+            m_nx = (int) ((max.x - m_min.x)/m_cellsize) + 1;
+            m_ny = (int) ((max.y - m_min.y)/m_cellsize) + 1;
+            m_nz = (int) ((max.z - m_min.z)/m_cellsize) + 1;
+            if ((dbl) m_nx * m_ny * m_nz <= 8.0*size + 1000.0) break;
+            m_cellsize *= 2.0;
+        } while (true);
+
+        //counting sort of the atoms by cell:
+        std::vector<uint> cells(size);
+        m_start.assign(m_nx*m_ny*m_nz + 1, 0);
+        for (uint i=0; i<size; i++)
+        {
+            int ix, iy, iz;
+            cell(coords[i], ix, iy, iz);
+            cells[i] = (iz*m_ny + iy)*m_nx + ix;
+            m_start[cells[i]+1]++;
+        }
+        for (uint k=1; k<m_start.size(); k++)
+            m_start[k] += m_start[k-1];
+
+        m_atoms.resize(size);
+        std::vector<uint> fill(m_start.begin(), m_start.end()-1);
+        for (uint i=0; i<size; i++)
+            m_atoms[fill[cells[i]]++] = i;
+    }
+
+    /// appends to out the atoms of the 27 cells around c (candidates closer than the cell size)
+    void candidates(const Coord3D& c, std::vector<uint>& out) const
+    {
+        int ix, iy, iz;
+        cell(c, ix, iy, iz);
+        for (int z=std::max(iz-1, 0); z<=std::min(iz+1, m_nz-1); z++)
+            for (int y=std::max(iy-1, 0); y<=std::min(iy+1, m_ny-1); y++)
+                for (int x=std::max(ix-1, 0); x<=std::min(ix+1, m_nx-1); x++)
+                {
+                    uint k = (z*m_ny + y)*m_nx + x;
+                    out.insert(out.end(), m_atoms.begin()+m_start[k], m_atoms.begin()+m_start[k+1]);
+                }
+    }
+
+private:
+
+    /// cell of a point (may be outside of the grid for the query points)
+    void cell(const Coord3D& c, int& ix, int& iy, int& iz) const
     {
-        //count++ ; // count number of line (unused at the moment)
-        //int size_line = line.size(); // count line length (unused at the moment)
-        //dbl data1=atof(line.substr(1,6).c_str()); // read first column - atom type id (unused at the moment)
-        dbl data2=atof(line.substr(7,13).c_str()); // read second column - radius (unused at the moment)
-        //dbl data3=atof(line.substr(14,20).c_str()); // read third column - solvation parameters (unused at the moment)
-        //std::string data4=line.substr(21,size_line).c_str(); // read last column (unused at the moment)
-        radi.push_back(data2);
-     }
+        ix = cellIndex((c.x - m_min.x)/m_cellsize, m_nx);
+        iy = cellIndex((c.y - m_min.y)/m_cellsize, m_ny);
+        iz = cellIndex((c.z - m_min.z)/m_cellsize, m_nz);
+    }
+
+    static int cellIndex(dbl x, int n)
+    {
+        //far from the grid: no neighbour cell
+        if (x < -1.0) return -2;
+        if (x >= n + 1.0) return n + 1;
+        return (int) floor(x);
+    }
+
+    Coord3D m_min;
+    dbl m_cellsize;
+    int m_nx, m_ny, m_nz;
+    std::vector<uint> m_start; ///< first atom of each cell in m_atoms (size: number of cells + 1)
+    std::vector<uint> m_atoms;
+};
+
+
+/// true if p is inside the sphere of one of the neighbours (squared radii in neighr2)
+static inline bool covered(const Coord3D& p, const std::vector<Coord3D>& neighcoords, const std::vector<dbl>& neighr2)
+{
+    for (uint l=0; l<neighcoords.size(); l++)
+        if (Norm2(p - neighcoords[l]) < neighr2[l]) return true;
+    return false;
 }
 
+
 Rigidbody Surface::surfpoint(const Rigidbody & rigid, dbl srad)
 {
+    std::vector<Coord3D> points;
+    std::vector<uint> parents;
+    surfpoint(rigid, srad, points, parents);
+
     Rigidbody rigidsurf;
+    for (uint k=0; k<points.size(); k++)
+        rigidsurf.AddAtom(rigid.GetAtomProperty(parents[k]), points[k]);
+    return rigidsurf;
+}
+
+
+void Surface::surfpoint(const Rigidbody & rigid, dbl srad, std::vector<Coord3D>& points, std::vector<uint>& parents)
+{
     int size_rigid = rigid.Size();
-    std::vector<int> neigh;
     radius.clear();
+    points.clear();
+    parents.clear();
 
-    // fix neighbours parameters if not initialized
+    // fix neighbours parameters if not initialized (no limit on the number of neighbours)
     if (!m_init)
     {
-        m_numneh = 2000;
+        m_numneh = 0;
         m_sradshift = 0.0;
     }
     // read radius
@@ -81,112 +215,137 @@ Rigidbody Surface::surfpoint(const Rigidbody & rigid, dbl srad)
     m_atomtypenumber.resize(size_rigid);
     for (uint i=0; i< rigid_tmp.Size(); i++)
     { m_atomtypenumber[i] = rigid_tmp.getAtomTypeNumber(i);}
+    dbl maxradius = 0.0;
     for (int i=0; i<size_rigid; i++)
     {
-        Atom m_atom = rigid_tmp.CopyAtom(i);
         radius.push_back(radi[m_atomtypenumber[i]]);
+        maxradius = std::max(maxradius, radius[i]);
     }
 
-    // generate grid points
+    std::vector<Coord3D> coords(size_rigid);
     for (int i=0; i<size_rigid; i++)
-        if ( radius[i] != 0.0 )
+        coords[i] = rigid.GetCoords(i);
+
+    // neighbours are closer than radius[i]+radius[j]+2*srad: cells of this size
+    SurfaceCellList grid(coords, 2.0*maxradius + 2.0*srad);
+
+    // atoms are processed in parallel by chunks, each chunk has its own output
+    // buffers: concatenating them in chunk order does not depend on the threads
+    const int chunksize = 64;
+    int nchunks = (size_rigid + chunksize - 1) / chunksize;
+    std::vector< std::vector<Coord3D> > chunkpoints(nchunks);
+    std::vector< std::vector<uint> > chunkparents(nchunks);
+    std::vector<char> toomany(nchunks, 0);
+
+    #pragma omp parallel
+    {
+        std::vector<uint> candidates;
+        std::vector<Coord3D> neighcoords;
+        std::vector<dbl> neighr2;
+
+        #pragma omp for schedule(dynamic,1)
+        for (int chunk=0; chunk<nchunks; chunk++)
         {
-            Coord3D coord1 = rigid.GetCoords(i);
-            int numneh = 0;
-            neigh.clear();
-            for (int j=0; j<size_rigid; j++) // generate neighbor list
-                if (i!=j)
+            std::vector<Coord3D>& outpoints = chunkpoints[chunk];
+            std::vector<uint>& outparents = chunkparents[chunk];
+
+            for (int i=chunk*chunksize; i<std::min((chunk+1)*chunksize, size_rigid); i++)
+            {
+                if ( radius[i] == 0.0 ) continue;
+
+                // generate neighbor list (coordinates and squared radii of the spheres)
+                const Coord3D& coord1 = coords[i];
+                candidates.clear();
+                grid.candidates(coord1, candidates);
+                neighcoords.clear();
+                neighr2.clear();
+                for (uint k=0; k<candidates.size(); k++)
                 {
-                    Coord3D coord2 = rigid.GetCoords(j);
-                    dbl ccdist = Norm2(coord1 - coord2);
+                    uint j = candidates[k];
+                    if ((int) j == i) continue;
                     dbl rr = (radius[i]+radius[j]+2.0*srad) * (radius[i]+radius[j]+2.0*srad);
-                    if (ccdist <= rr)
-                    { neigh.push_back(j);
-                        numneh+=1;
-                        if  ( numneh > m_numneh )
-                        {
-                            std::string msg = " ERROR: Atom has too many neighbors \n"  ;
-                            std::cout << msg;
-                            throw msg;
-                        }
+                    if (Norm2(coord1 - coords[j]) <= rr)
+                    {
+                        neighcoords.push_back(coords[j]);
+                        neighr2.push_back((radius[j] + srad+m_sradshift)*(radius[j] + srad+m_sradshift));
                     }
                 }
-            numneh = numneh - 1;
-            for (int j=0; j<m_ncosth; j++) // generate points around each atoms
-            {
-                dbl costh = csth[j];
-                dbl sinth = snth[j];
-                for (int k=0; k<m_nphi; k++)
+                if (m_numneh > 0 && (int) neighcoords.size() > m_numneh)
                 {
-                    dbl cphigh = cos_phgh[k];
-                    dbl sphigh = sin_phgh[k];
-                    Coord3D coord4;
-                    coord4.x = (radius[i]+srad+m_sradshift)*sinth*cphigh;
-                    coord4.y = (radius[i]+srad+m_sradshift)*sinth*sphigh;
-                    coord4.z = (radius[i]+srad+m_sradshift)*costh;
-                    int l = 0;
-                    bool coverd = false;
-                    while ((!coverd) && (l <= numneh))
-                    {
-                        Coord3D coord5 = rigid.GetCoords(neigh[l]);
-                        dbl ddd = Norm2(coord1 + coord4 - coord5);
-                        if (ddd < (radius[neigh[l]] + srad+m_sradshift)*(radius[neigh[l]] + srad+m_sradshift))
-                        { coverd = true; }
-                        l+=1;
-                    }
-                    if (!coverd)
-                    {
-                        Atom m_atom2 = rigid.CopyAtom(i);
-                        m_atom2.SetCoords(coord1 + coord4);
-                        rigidsurf.AddAtom(m_atom2);
-                    }
+                    toomany[chunk] = 1;
+                    break;
                 }
-            }
 
-            // fill the top and bottom positions
-            dbl costh = -1;
-            while (costh<=1.0)
-            {
-                Coord3D coord4;
-                coord4.x = 0.0;
-                coord4.y = 0.0;
-                coord4.z = (radius[i]+srad+m_sradshift)*costh;
-                int l = 0;
-                bool coverd = false;
-                while ((!coverd) && (l <= numneh))
+                dbl r = radius[i]+srad+m_sradshift;
+                for (int j=0; j<m_ncosth; j++) // generate points around each atoms
                 {
-                    Coord3D coord5 = rigid.GetCoords(neigh[l]);
-                    dbl ddd = Norm2(coord1 + coord4 - coord5);
-                    if (ddd < (radius[neigh[l]] + srad+m_sradshift)*(radius[neigh[l]] + srad+m_sradshift))
-                    { coverd = true; }
-                    l+=1;
+                    for (int k=0; k<m_nphi; k++)
+                    {
+                        Coord3D coord4(r*snth[j]*cos_phgh[k], r*snth[j]*sin_phgh[k], r*csth[j]);
+                        if (!covered(coord1 + coord4, neighcoords, neighr2))
+                        {
+                            outpoints.push_back(coord1 + coord4);
+                            outparents.push_back(i);
+                        }
+                    }
                 }
-                if (!coverd)
+
+                // fill the top and bottom positions
+                for (dbl costh = -1.0; costh<=1.0; costh+=2.0)
                 {
-                    Atom m_atom2 = rigid.CopyAtom(i);
-                    m_atom2.SetCoords(coord1 + coord4);
-                    rigidsurf.AddAtom(m_atom2);
+                    Coord3D coord4(0.0, 0.0, r*costh);
+                    if (!covered(coord1 + coord4, neighcoords, neighr2))
+                    {
+                        outpoints.push_back(coord1 + coord4);
+                        outparents.push_back(i);
+                    }
                 }
-                costh+=2;
             }
         }
-    return rigidsurf;
+    }
+
+    if (std::find(toomany.begin(), toomany.end(), 1) != toomany.end())
+    {
+        std::string msg = " ERROR: Atom has too many neighbors \n"  ;
+        std::cout << msg;
+        throw msg;
+    }
+
+    uint total = 0;
+    for (int chunk=0; chunk<nchunks; chunk++)
+        total += chunkpoints[chunk].size();
+    points.reserve(total);
+    parents.reserve(total);
+    for (int chunk=0; chunk<nchunks; chunk++)
+    {
+        points.insert(points.end(), chunkpoints[chunk].begin(), chunkpoints[chunk].end());
+        parents.insert(parents.end(), chunkparents[chunk].begin(), chunkparents[chunk].end());
+    }
 }
 
 Rigidbody Surface::outergrid(const Rigidbody & rigid1, const Rigidbody & rigid2, dbl srad)
 {
+    // srad is a squared distance
     int size1 = rigid1.Size();
     int size2 = rigid2.Size();
     Rigidbody rigid3;
+
+    std::vector<Coord3D> coords2(size2);
+    for (int j=0; j<size2; j++)
+        coords2[j] = rigid2.GetCoords(j);
+    SurfaceCellList grid(coords2, sqrt(std::max(srad, 0.0)));
+
+    std::vector<uint> candidates;
     for (int i=0; i<size1; i++)
     {
         Coord3D xyz1 = rigid1.GetCoords(i);
         bool select = true;
-        for (int j=0; j<size2; j++)
+        candidates.clear();
+        grid.candidates(xyz1, candidates);
+        for (uint k=0; k<candidates.size(); k++)
         {
-            Coord3D xyz2 = rigid2.GetCoords(j);
-            dbl dist=Norm2(xyz1-xyz2);
-            if (dist < srad) { select = false; }
+            dbl dist=Norm2(xyz1-coords2[candidates[k]]);
+            if (dist < srad) { select = false; break; }
         }
         if (select) { rigid3.AddAtom(rigid1.CopyAtom(i)); }
     }
@@ -195,26 +354,217 @@ Rigidbody Surface::outergrid(const Rigidbody & rigid1, const Rigidbody & rigid2,
 
 Rigidbody Surface::removeclosest(const Rigidbody & rigid, dbl srad)
 {
-    std::vector<bool> list,list2;
+    // greedy thinning in the order of the points: a point that is kept
+    // removes all the points closer than srad
     int size=rigid.Size();
     Rigidbody rigid2;
-    list.clear();
+
+    std::vector<Coord3D> coords(size);
+    for (int i=0; i<size; i++)
+        coords[i] = rigid.GetCoords(i);
+    SurfaceCellList grid(coords, fabs(srad));
+
+    std::vector<bool> list(size, true);
+    std::vector<uint> candidates;
     srad=srad*srad;
-    for (int i=0; i<size; i++) { list.push_back(true); }
     for (int i=0; i<size; i++)
     {
-        Coord3D  xyz1 = rigid.GetCoords(i);
-        for (int j=0; j<size; j++)
-            if ((list[i]) && (i!=j))
-            {
-                Coord3D  xyz2 = rigid.GetCoords(j);
-                dbl dist=Norm2(xyz1 - xyz2);
-                if (dist < srad) { list[j] = false; }
-            }
+        if (!list[i]) continue;
+        candidates.clear();
+        grid.candidates(coords[i], candidates);
+        for (uint k=0; k<candidates.size(); k++)
+        {
+            int j = candidates[k];
+            if ((i!=j) && (Norm2(coords[i] - coords[j]) < srad)) { list[j] = false; }
+        }
     }
     for (int i=0; i<size; i++)
     if (list[i]) { rigid2.AddAtom(rigid.CopyAtom(i)); }
     return rigid2;
 }
 
+
+
+///////////////////////////////////////////////////
+//     solvent accessible surface area
+///////////////////////////////////////////////////
+
+
+void Surface::setSasaPoints(uint npoints)
+{
+    if (npoints == 0) throw std::invalid_argument("Surface::setSasaPoints: at least one point is needed");
+
+    //golden section spiral: nearly uniform points on the unit sphere
+    const dbl pi = 3.141592654;
+    const dbl increment = pi * (3.0 - sqrt(5.0));
+    m_spherepoints.clear();
+    for (uint k=0; k<npoints; k++)
+    {
+        dbl y = 1.0 - (k + 0.5) * 2.0 / npoints;
+        dbl r = sqrt(1.0 - y*y);
+        dbl phi = k * increment;
+        m_spherepoints.push_back(Coord3D(cos(phi)*r, y, sin(phi)*r));
+    }
+}
+
+
+std::vector<dbl> Surface::atomRadii(const Rigidbody& rigid) const
+{
+    AttractRigidbody rigid_tmp(rigid);
+    std::vector<dbl> radii(rigid.Size());
+    for (uint i=0; i<rigid.Size(); i++)
+    {
+        uint type = rigid_tmp.getAtomTypeNumber(i);
+        if (type >= radi.size()) throw std::out_of_range("Surface: atom type without solvation parameters");
+        radii[i] = radi[type];
+    }
+    return radii;
+}
+
+
+/*! \brief accessible area of some atoms (Shrake-Rupley)
+*
+*   coords and R (radius + probe, 0 for ignored atoms) describe all the atoms,
+*   grid is a cell list of coords with cells larger than 2*max(R).
+*   Points of the sphere of an atom are buried by its neighbours, nearest first,
+*   and are tracked in a bitmask: buried points are not tested again.
+*/
+static void sasaAtoms(const std::vector<Coord3D>& coords, const std::vector<dbl>& R, const SurfaceCellList& grid,
+                      const std::vector<Coord3D>& spherepoints, const std::vector<uint>& atoms, std::vector<dbl>& area)
+{
+    const dbl pi = 3.141592654;
+    const uint npoints = spherepoints.size();
+    const uint nwords = (npoints + 63) / 64;
+    const int natoms = atoms.size();
+
+    #pragma omp parallel
+    {
+        std::vector<uint> candidates;
+        std::vector< std::pair<dbl, uint> > neighbours;
+        std::vector<unsigned long long> buried(nwords);
+
+        #pragma omp for schedule(dynamic,16)
+        for (int a=0; a<natoms; a++)
+        {
+            uint i = atoms[a];
+            dbl Ri = R[i];
+            if (Ri == 0.0) {area[i] = 0.0; continue;}
+
+            //neighbours sorted by distance
+            candidates.clear();
+            grid.candidates(coords[i], candidates);
+            neighbours.clear();
+            for (uint k=0; k<candidates.size(); k++)
+            {
+                uint j = candidates[k];
+                if (j == i || R[j] == 0.0) continue;
+                dbl d2 = Norm2(coords[j] - coords[i]);
+                if (d2 < (Ri + R[j])*(Ri + R[j]))
+                    neighbours.push_back(std::make_pair(d2, j));
+            }
+            std::sort(neighbours.begin(), neighbours.end());
+
+            //point u of the sphere is buried by j if |Ri.u - d|^2 < Rj^2, ie u.d > (Ri^2 + d^2 - Rj^2)/(2 Ri)
+            std::fill(buried.begin(), buried.end(), 0ULL);
+            uint nburied = 0;
+            for (uint l=0; l<neighbours.size() && nburied < npoints; l++)
+            {
+                uint j = neighbours[l].second;
+                Coord3D d = coords[j] - coords[i];
+                dbl threshold = (Ri*Ri + neighbours[l].first - R[j]*R[j]) / (2.0*Ri);
+                for (uint w=0; w<nwords; w++)
+                {
+                    if (buried[w] == ~0ULL) continue;
+                    uint end = std::min(64u, npoints - 64*w);
+                    for (uint b=0; b<end; b++)
+                    {
+                        unsigned long long bit = 1ULL << b;
+                        if (buried[w] & bit) continue;
+                        const Coord3D& u = spherepoints[64*w + b];
+                        if (u.x*d.x + u.y*d.y + u.z*d.z > threshold)
+                        {
+                            buried[w] |= bit;
+                            nburied++;
+                        }
+                    }
+                }
+            }
+
+            area[i] = 4.0*pi*Ri*Ri * (dbl) (npoints - nburied) / (dbl) npoints;
+        }
+    }
+}
+
+
+std::vector<dbl> Surface::sasa(const Rigidbody& rigid, dbl probe)
+{
+    uint size = rigid.Size();
+    std::vector<dbl> R = atomRadii(rigid);
+    std::vector<Coord3D> coords(size);
+    dbl maxR = 0.0;
+    for (uint i=0; i<size; i++)
+    {
+        coords[i] = rigid.GetCoords(i);
+        if (R[i] != 0.0) R[i] += probe;
+        maxR = std::max(maxR, R[i]);
+    }
+
+    SurfaceCellList grid(coords, 2.0*maxR);
+    std::vector<uint> atoms(size);
+    for (uint i=0; i<size; i++) atoms[i] = i;
+
+    std::vector<dbl> area(size, 0.0);
+    sasaAtoms(coords, R, grid, m_spherepoints, atoms, area);
+    return area;
+}
+
+
+std::vector<dbl> Surface::sasaInterface(const Rigidbody& rigid, const Rigidbody& partner, const std::vector<dbl>& unbound, dbl probe)
+{
+    uint size = rigid.Size();
+    if (unbound.size() != size)
+        throw std::invalid_argument("Surface::sasaInterface: unbound areas do not match the number of atoms");
+
+    //atoms of rigid then atoms of partner:
+    std::vector<dbl> R = atomRadii(rigid);
+    std::vector<dbl> Rpartner = atomRadii(partner);
+    R.insert(R.end(), Rpartner.begin(), Rpartner.end());
+    std::vector<Coord3D> coords(R.size());
+    dbl maxR = 0.0;
+    for (uint i=0; i<R.size(); i++)
+    {
+        coords[i] = (i < size) ? rigid.GetCoords(i) : partner.GetCoords(i-size);
+        if (R[i] != 0.0) R[i] += probe;
+        maxR = std::max(maxR, R[i]);
+    }
+
+    SurfaceCellList grid(coords, 2.0*maxR);
+
+    //only the atoms of rigid that touch an atom of the partner have a new area
+    std::vector<uint> atoms;
+    std::vector<uint> candidates;
+    for (uint i=0; i<size; i++)
+    {
+        if (R[i] == 0.0) continue;
+        candidates.clear();
+        grid.candidates(coords[i], candidates);
+        for (uint k=0; k<candidates.size(); k++)
+        {
+            uint j = candidates[k];
+            if (j >= size && R[j] != 0.0 && Norm2(coords[j] - coords[i]) < (R[i] + R[j])*(R[i] + R[j]))
+            {
+                atoms.push_back(i);
+                break;
+            }
+        }
+    }
+
+    std::vector<dbl> area(unbound);
+    area.resize(R.size(), 0.0);
+    sasaAtoms(coords, R, grid, m_spherepoints, atoms, area);
+    area.resize(size);
+    return area;
+}
+
+
 }//namespace PTools
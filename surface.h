@@ -11,6 +11,16 @@
 namespace PTools
 {
 
+/*! \brief reads a file of solvation parameters like solv.dat
+*
+*   columns: Attract atom type (from 1), radius, solvation parameter, name. Rows
+*   are indexed by their type: radius[t] and param[t] belong to type t+1 (the atom
+*   type numbers of AttractRigidbody), in any order. Every type up to the largest
+*   one must be given once.
+*/
+void ReadSolvationParameters(const std::string& file, std::vector<dbl>& radius, std::vector<dbl>& param);
+
+
 class Surface
 {
 
@@ -23,18 +33,25 @@ public:
         setUp(nphi, ncosth);
         m_init=false;
         readsolvparam(file);
+        setSasaPoints(256);
     };
 
     Rigidbody surfpoint(const Rigidbody & rigid, dbl srad); /// generate a grid of point around the protein
-    void surfpointParams(int max, dbl shift); /// initialize some parameters of the grid generation
+    void surfpoint(const Rigidbody & rigid, dbl srad, std::vector<Coord3D>& points, std::vector<uint>& parents); /// same points without building a Rigidbody (parents: index of the atom of each point)
+    void surfpointParams(int max, dbl shift); /// initialize some parameters of the grid generation (max: limit on the number of neighbours of an atom, 0: no limit)
     Rigidbody outergrid(const Rigidbody & rigid1, const Rigidbody & rigid2, dbl srad); /// remove overlap between rigid1 and rigid2
     Rigidbody removeclosest(const Rigidbody & rigid1, dbl srad); /// fix the density of the grid (remove points that are too close to eachother)
     void readsolvparam(const std::string& file); /// read solvation parameters
+
+    std::vector<dbl> sasa(const Rigidbody& rigid, dbl probe=1.4); /// solvent accessible surface area of each atom (Shrake-Rupley)
+    std::vector<dbl> sasaInterface(const Rigidbody& rigid, const Rigidbody& partner, const std::vector<dbl>& unbound, dbl probe=1.4); /// area of each atom of rigid in presence of partner, only atoms in contact are recomputed (unbound: sasa(rigid))
+    void setSasaPoints(uint npoints); /// number of points on the sphere of each atom for sasa (default 256)
     
 private:
 
     //private functions
     void setUp(int nphi, int ncosth);
+    std::vector<dbl> atomRadii(const Rigidbody& rigid) const;
 
     //private data
     int m_nphi, m_ncosth;
@@ -44,6 +61,7 @@ private:
     std::vector<dbl>  csth , snth, cos_phgh , sin_phgh;
     std::vector<dbl>  radi, radius;
     std::vector<int> m_atomtypenumber;
+    std::vector<Coord3D> m_spherepoints; ///< unit sphere points for sasa
 
 };
 